@@ -0,0 +1,24 @@
+#hashes the code generator and runtime sources into a header, cached object code is only
+#loaded by a build of the same code generator and runtime and the version alone doesn't
+#change when they do.
+#run with cmake -P at build time so edits are picked up without rerunning cmake,
+#the header is only rewritten when the hash changes
+#  CODEGEN_SOURCE_DIR: the src directory
+#  CODEGEN_HASH_HEADER: the header to write
+
+file(GLOB codegen_files
+  ${CODEGEN_SOURCE_DIR}/llvmcodegen/*.cc
+  ${CODEGEN_SOURCE_DIR}/llvmcodegen/*.h
+  ${CODEGEN_SOURCE_DIR}/interpreter/simplify.*
+  ${CODEGEN_SOURCE_DIR}/runtime.cc
+  ${CODEGEN_SOURCE_DIR}/runtime.h
+)
+list(SORT codegen_files)
+set(codegen_hashes "")
+foreach(f ${codegen_files})
+  file(SHA1 ${f} h)
+  set(codegen_hashes "${codegen_hashes}${h}")
+endforeach()
+string(SHA1 jit_expr_CODEGEN_HASH "${codegen_hashes}")
+
+configure_file("${CODEGEN_SOURCE_DIR}/jit_expr_codegen.h.in" "${CODEGEN_HASH_HEADER}")
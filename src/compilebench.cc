@@ -0,0 +1,231 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+//times each step of compiling the expressions in a corpus, runs without pd
+//
+//  compilebench [-n repeats] [-cpu name] [-fastmath] [-accuracy name] files...
+//
+//.pd files contribute their expr, expr~ and fexpr~ objects, jit or not, other files have an
+//expression per line, optionally after the object name like process.rb prints them.
+//every expression is compiled repeats times, the median of each step is printed in
+//microseconds followed by the totals and percentiles over the corpus
+
+#include "parse/driver.hh"
+#include "interpreter/simplify.h"
+#include "llvmcodegen/codegen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+
+namespace {
+  using timer = std::chrono::steady_clock;
+  double seconds(timer::time_point start) {
+    return std::chrono::duration<double>(timer::now() - start).count();
+  }
+
+  const std::vector<std::string> object_names = {
+    "expr", "expr~", "fexpr~", "jit/expr", "jit/expr~", "jit/fexpr~"
+  };
+  const std::vector<std::string> step_names = {
+    "parse", "simplify", "generate", "optimize", "emit", "load"
+  };
+
+  struct Expression {
+    std::string object;
+    std::string source;
+  };
+
+  //seconds spent in each of step_names
+  typedef std::vector<double> Steps;
+
+  bool is_object_name(const std::string& name) {
+    return std::find(object_names.begin(), object_names.end(), name) != object_names.end();
+  }
+
+  //the messages in a patch end with a ; that isn't escaped
+  void read_patch(std::istream& in, std::vector<Expression>& corpus) {
+    std::string record;
+    char c;
+    while (in.get(c)) {
+      if (c != ';' || (record.size() && record.back() == '\\')) {
+        record += (c == '\n') ? ' ' : c;
+        continue;
+      }
+      std::istringstream r(record);
+      std::string chunk, type, x, y, name, source;
+      r >> chunk >> type >> x >> y >> name;
+      std::getline(r, source);
+      if (chunk == "#X" && type == "obj" && is_object_name(name) && source.find_first_not_of(' ') != std::string::npos)
+        corpus.push_back({name, source});
+      record.clear();
+    }
+  }
+
+  void read_lines(std::istream& in, std::vector<Expression>& corpus) {
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.find_first_not_of(" \t") == std::string::npos)
+        continue;
+      std::istringstream l(line);
+      std::string name;
+      l >> name;
+      if (is_object_name(name)) {
+        std::getline(l, line);
+      } else {
+        name = "expr~";
+        line = " " + line;
+      }
+      corpus.push_back({name, line});
+    }
+  }
+
+  Steps compile(parse::Driver& driver, const std::string& source, const xnor::CompileOptions& options) {
+    Steps steps;
+    auto start = timer::now();
+    auto trees = driver.parse_string(source);
+    steps.push_back(seconds(start));
+
+    start = timer::now();
+    auto statements = xnor::simplify(trees, options.accuracy);
+    steps.push_back(seconds(start));
+    driver.reset();
+
+    xnor::LLVMCodeGenVisitor::intern(statements);
+    xnor::LLVMCodeGenVisitor cv(options);
+    cv.function(statements);
+    xnor::JIT::instance().removeObject(cv.handle());
+
+    auto& t = cv.timings();
+    steps.insert(steps.end(), {t.generate, t.optimize, t.emit, t.load});
+    return steps;
+  }
+
+  double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values.at(rank > 0 ? rank - 1 : 0);
+  }
+
+  double us(double seconds) { return seconds * 1e6; }
+
+  void usage() {
+    cerr << "usage: compilebench [-n repeats] [-cpu name] [-fastmath] [-accuracy precise|fast|libm] files..." << endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char * argv[]) {
+  int repeats = 5;
+  xnor::CompileOptions options;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc) {
+      repeats = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-cpu" && i + 1 < argc) {
+      options.cpu = argv[++i];
+    } else if (arg == "-fastmath") {
+      options.fastmath = true;
+    } else if (arg == "-accuracy" && i + 1 < argc) {
+      if (!xnor::MathLibrary::parse(argv[++i], options.accuracy))
+        usage();
+    } else if (arg.size() && arg[0] == '-') {
+      usage();
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty())
+    usage();
+
+  std::vector<Expression> corpus;
+  for (auto f: files) {
+    std::ifstream in(f);
+    if (!in) {
+      cerr << "cannot open " << f << endl;
+      return 1;
+    }
+    if (f.size() > 3 && f.compare(f.size() - 3, 3, ".pd") == 0)
+      read_patch(in, corpus);
+    else
+      read_lines(in, corpus);
+  }
+
+  xnor::LLVMCodeGenVisitor::init();
+  try {
+    xnor::JIT::instance().targetMachine(options.cpu);
+  } catch (std::runtime_error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  parse::Driver driver;
+  //the medians of each expression, by step, and their sums
+  std::vector<std::vector<double>> steps(step_names.size());
+  std::vector<double> totals;
+  int failures = 0;
+
+  for (auto name: step_names)
+    printf("%10s ", name.c_str());
+  printf("%10s  expression\n", "total");
+
+  for (auto& e: corpus) {
+    std::vector<Steps> runs;
+    try {
+      for (int i = 0; i < repeats; i++)
+        runs.push_back(compile(driver, e.source, options));
+    } catch (std::runtime_error& err) {
+      cerr << "fail: " << e.object << e.source << ": " << err.what() << endl;
+      failures++;
+      continue;
+    }
+
+    double total = 0;
+    for (size_t s = 0; s < step_names.size(); s++) {
+      std::vector<double> values;
+      for (auto& r: runs)
+        values.push_back(r.at(s));
+      auto median = percentile(values, 0.5);
+      steps.at(s).push_back(median);
+      total += median;
+      printf("%10.1f ", us(median));
+    }
+    totals.push_back(total);
+    printf("%10.1f  %s%s\n", us(total), e.object.c_str(), e.source.c_str());
+  }
+
+  if (totals.empty()) {
+    cerr << "no expressions compiled" << endl;
+    return 1;
+  }
+
+  printf("\n%zu expressions, %d failed, %d repeats, times in microseconds\n", totals.size(), failures, repeats);
+  printf("%10s %12s %10s %10s %10s %10s %10s\n", "step", "sum", "mean", "p50", "p90", "p99", "max");
+  auto summary = [](const std::string& name, const std::vector<double>& values) {
+    double sum = 0;
+    for (auto v: values)
+      sum += v;
+    printf("%10s %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name.c_str(),
+        us(sum), us(sum / values.size()),
+        us(percentile(values, 0.5)), us(percentile(values, 0.9)), us(percentile(values, 0.99)),
+        us(percentile(values, 1.0)));
+  };
+  for (size_t s = 0; s < step_names.size(); s++)
+    summary(step_names.at(s), steps.at(s));
+  summary("total", totals);
+
+  return failures ? 2 : 0;
+}
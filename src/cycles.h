@@ -0,0 +1,33 @@
+//Copyright (c) Alex Norman, 2018.
+//see LICENSE-xnor
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define XNOR_CYCLES_TSC 1
+#else
+#include <chrono>
+#endif
+
+namespace xnor {
+  //time stamp counter ticks where there is one, which may not run at the core clock,
+  //otherwise nanoseconds
+  inline uint64_t cycles() {
+#ifdef XNOR_CYCLES_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  inline const char * cycles_unit() {
+#ifdef XNOR_CYCLES_TSC
+    return "cycles";
+#else
+    return "ns";
+#endif
+  }
+}
@@ -0,0 +1,705 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+//runs a corpus through the compiled kernels and through a reference evaluator that follows the
+//semantics of pd's expr, expr~ and fexpr~ (x_vexpr), reports how much faster the kernels are and
+//how far their results are from the reference, and flags the expressions that are slower or diverge
+//
+//  exprdiff [-block n] [-blocks n] [-ulp n] [-seconds s] [-inplace] [-cpu name] [-fastmath]
+//      [-accuracy name] [-f file] [expression]...
+//
+//expressions are given like kernelbench takes them, jit/expr is run a frame at a time.
+//the reference is a tree walking evaluator like vexpr, so its speed stands in for vanilla expr:
+//  * values are ints or floats, int constants, $i inputs, comparisons, logic, bit operations,
+//    % and int() give ints. + - * / of two ints are done with ints
+//  * division and % by zero give 0, % works on the integer parts
+//  * functions are computed in double precision and rounded, like vexpr calls libm
+//  * $x and $y read up to a block back, fractional indexes interpolate linearly
+//  * table indexes are truncated and clamped, Sum(t, a, b) adds a through b inclusive
+//  * random(a, b) gives integers from a up to but not including b, the kernel's values are
+//    checked against those bounds and then used by the reference so $y history stays comparable
+
+#include "kernelharness.h"
+#include "pdstub.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+
+namespace ast = xnor::ast;
+
+namespace {
+  using timer = std::chrono::steady_clock;
+
+  const std::string table_name = "array1";
+  const size_t table_size = 100;
+
+  std::vector<float> table_contents() {
+    std::vector<float> t(table_size);
+    for (size_t i = 0; i < t.size(); i++)
+      t[i] = static_cast<float>(i) * 0.5f - 10.0f;
+    return t;
+  }
+
+  //test signals cross zero and integers so truncation and modulo matter
+  float wave(size_t input, long frame) {
+    return 8.0f * std::sin(0.05f * static_cast<float>(frame + 1) * static_cast<float>(input + 1));
+  }
+
+  float control(size_t input, long call) {
+    return std::round(16.0f * std::sin(0.7f * static_cast<float>(call + 1) * static_cast<float>(input + 1))) * 0.25f;
+  }
+
+  const std::map<std::string, double (*)(double)> unary_functions = {
+    {"abs", [](double v) { return std::fabs(v); }},
+    {"acos", [](double v) { return std::acos(v); }},
+    {"acosh", [](double v) { return std::acosh(v); }},
+    {"asin", [](double v) { return std::asin(v); }},
+    {"asinh", [](double v) { return std::asinh(v); }},
+    {"atan", [](double v) { return std::atan(v); }},
+    {"atanh", [](double v) { return std::atanh(v); }},
+    {"cbrt", [](double v) { return std::cbrt(v); }},
+    {"ceil", [](double v) { return std::ceil(v); }},
+    {"cos", [](double v) { return std::cos(v); }},
+    {"cosh", [](double v) { return std::cosh(v); }},
+    {"erf", [](double v) { return std::erf(v); }},
+    {"erfc", [](double v) { return std::erfc(v); }},
+    {"exp", [](double v) { return std::exp(v); }},
+    {"expm1", [](double v) { return std::expm1(v); }},
+    {"fact", [](double v) {
+      double r = 1;
+      for (int i = 2; i <= static_cast<int>(v); i++)
+        r *= i;
+      return r;
+    }},
+    {"finite", [](double v) { return std::isfinite(v) ? 1.0 : 0.0; }},
+    {"floor", [](double v) { return std::floor(v); }},
+    {"imodf", [](double v) { return std::trunc(v); }},
+    {"isinf", [](double v) { return std::isinf(v) ? 1.0 : 0.0; }},
+    {"isnan", [](double v) { return std::isnan(v) ? 1.0 : 0.0; }},
+    {"ln", [](double v) { return std::log(v); }},
+    {"log", [](double v) { return std::log(v); }},
+    {"log10", [](double v) { return std::log10(v); }},
+    {"log1p", [](double v) { return std::log1p(v); }},
+    {"modf", [](double v) { return v - std::trunc(v); }},
+    {"nearbyint", [](double v) { return std::nearbyint(v); }},
+    {"rint", [](double v) { return std::rint(v); }},
+    {"round", [](double v) { return std::round(v); }},
+    {"sin", [](double v) { return std::sin(v); }},
+    {"sinh", [](double v) { return std::sinh(v); }},
+    {"sqrt", [](double v) { return std::sqrt(v); }},
+    {"tan", [](double v) { return std::tan(v); }},
+    {"tanh", [](double v) { return std::tanh(v); }},
+    {"trunc", [](double v) { return std::trunc(v); }},
+  };
+
+  const std::map<std::string, double (*)(double, double)> binary_functions = {
+    {"atan2", [](double a, double b) { return std::atan2(a, b); }},
+    {"copysign", [](double a, double b) { return std::copysign(a, b); }},
+    {"fmod", [](double a, double b) { return std::fmod(a, b); }},
+    {"ldexp", [](double a, double b) { return std::ldexp(a, static_cast<int>(b)); }},
+    {"max", [](double a, double b) { return std::max(a, b); }},
+    {"min", [](double a, double b) { return std::min(a, b); }},
+    {"pow", [](double a, double b) { return std::pow(a, b); }},
+    {"remainder", [](double a, double b) { return std::remainder(a, b); }},
+  };
+
+  //statements that call random can only be compared by their bounds
+  class RandomVisitor : public ast::RecursiveVisitor {
+    public:
+      using ast::RecursiveVisitor::visit;
+      bool found = false;
+
+      virtual void visit(ast::FunctionCall* v) {
+        found = found || v->name() == "random";
+        ast::RecursiveVisitor::visit(v);
+      }
+  };
+
+  //evaluates the parsed trees a frame at a time with vexpr's rules
+  class Reference : public ast::Visitor {
+    public:
+      //the float or int that vexpr would hold
+      struct Value {
+        double v;
+        bool integer;
+      };
+
+      Reference(const harness::Kernel& k, int n) : mKernel(k), mN(n) {
+        mFloats.resize(k.input_types.size(), 0);
+        mVectors.resize(k.input_types.size());
+        mPrevious.resize(k.input_types.size(), std::vector<float>(n, 0));
+        mOutputs.resize(k.outputs, std::vector<float>(n, 0));
+        mPreviousOutputs.resize(k.outputs, std::vector<float>(n, 0));
+        mTables[table_name] = table_contents();
+      }
+
+      void set_float(size_t input, float v) { mFloats.at(input) = v; }
+      //the vectors must stay valid until the block is done
+      void set_vector(size_t input, const float * v) { mVectors.at(input) = v; }
+
+      //the block is done, its inputs and outputs become the history
+      void next_block() {
+        for (size_t i = 0; i < mVectors.size(); i++) {
+          if (mVectors[i])
+            std::copy(mVectors[i], mVectors[i] + mN, mPrevious[i].begin());
+        }
+        std::swap(mOutputs, mPreviousOutputs);
+      }
+
+      float evaluate(size_t statement, int frame) {
+        mFrame = frame;
+        mRandomCall = false;
+        float v = static_cast<float>(evaluate(mKernel.trees.at(statement)).v);
+        mOutputs.at(statement).at(frame) = v;
+        return v;
+      }
+
+      //inclusive bounds of the random() call that is the whole statement
+      bool random_call() const { return mRandomCall; }
+      int random_low() const { return mRandomLow; }
+      int random_high() const { return mRandomHigh; }
+
+      void set_output(size_t statement, int frame, float v) { mOutputs.at(statement).at(frame) = v; }
+
+      virtual void visit(ast::Variable* v) {
+        auto i = v->input_index();
+        switch (v->type()) {
+          case ast::Variable::VarType::FLOAT:
+            mValue = {mFloats.at(i), false};
+            break;
+          case ast::Variable::VarType::INT:
+            mValue = {std::trunc(static_cast<double>(mFloats.at(i))), true};
+            break;
+          case ast::Variable::VarType::VECTOR:
+          case ast::Variable::VarType::INPUT:
+            mValue = {mVectors.at(i)[mFrame], false};
+            break;
+          default:
+            throw std::runtime_error("variable cannot be used as a value");
+        }
+      }
+
+      virtual void visit(ast::Value<int>* v) {
+        mValue = {static_cast<double>(v->value()), v->output_type() == ast::Node::OutputType::INT};
+      }
+      virtual void visit(ast::Value<float>* v) { mValue = {v->value(), false}; }
+      virtual void visit(ast::Value<std::string>* v) { mValue = {mValues[v->value()], false}; }
+      virtual void visit(ast::Quoted* /*v*/) { throw std::runtime_error("symbol used as a value"); }
+
+      virtual void visit(ast::UnaryOp* v) {
+        auto a = evaluate(v->node());
+        switch (v->op()) {
+          case ast::UnaryOp::Op::NEGATE:
+            mValue = {a.integer ? static_cast<double>(-to_int(a)) : static_cast<double>(-static_cast<float>(a.v)), a.integer};
+            break;
+          case ast::UnaryOp::Op::LOGICAL_NOT:
+            mValue = {a.v == 0 ? 1.0 : 0.0, true};
+            break;
+          case ast::UnaryOp::Op::BIT_NOT:
+            mValue = {static_cast<double>(~to_int(a)), true};
+            break;
+        }
+      }
+
+      virtual void visit(ast::BinaryOp* v) {
+        auto l = evaluate(v->left());
+        auto r = evaluate(v->right());
+        bool integer = l.integer && r.integer;
+        float lf = static_cast<float>(l.v);
+        float rf = static_cast<float>(r.v);
+        long li = to_int(l);
+        long ri = to_int(r);
+
+        switch (v->op()) {
+          case ast::BinaryOp::Op::ADD:
+            mValue = integer ? number(li + ri) : Value{lf + rf, false};
+            break;
+          case ast::BinaryOp::Op::SUBTRACT:
+            mValue = integer ? number(li - ri) : Value{lf - rf, false};
+            break;
+          case ast::BinaryOp::Op::MULTIPLY:
+            mValue = integer ? number(li * ri) : Value{lf * rf, false};
+            break;
+          case ast::BinaryOp::Op::DIVIDE:
+            if (integer)
+              mValue = number(ri == 0 ? 0 : li / ri);
+            else
+              mValue = {rf == 0.0f ? 0.0f : lf / rf, false};
+            break;
+          case ast::BinaryOp::Op::MOD:
+            mValue = {ri == 0 ? 0.0 : static_cast<double>(li % ri), integer};
+            break;
+          case ast::BinaryOp::Op::SHIFT_LEFT:
+            mValue = number(li << (ri & 31));
+            break;
+          case ast::BinaryOp::Op::SHIFT_RIGHT:
+            mValue = number(li >> (ri & 31));
+            break;
+          case ast::BinaryOp::Op::COMP_EQUAL:
+            mValue = boolean(integer ? li == ri : lf == rf);
+            break;
+          case ast::BinaryOp::Op::COMP_NOT_EQUAL:
+            mValue = boolean(integer ? li != ri : lf != rf);
+            break;
+          case ast::BinaryOp::Op::COMP_GREATER:
+            mValue = boolean(integer ? li > ri : lf > rf);
+            break;
+          case ast::BinaryOp::Op::COMP_LESS:
+            mValue = boolean(integer ? li < ri : lf < rf);
+            break;
+          case ast::BinaryOp::Op::COMP_GREATER_OR_EQUAL:
+            mValue = boolean(integer ? li >= ri : lf >= rf);
+            break;
+          case ast::BinaryOp::Op::COMP_LESS_OR_EQUAL:
+            mValue = boolean(integer ? li <= ri : lf <= rf);
+            break;
+          case ast::BinaryOp::Op::LOGICAL_OR:
+            mValue = boolean(l.v != 0 || r.v != 0);
+            break;
+          case ast::BinaryOp::Op::LOGICAL_AND:
+            mValue = boolean(l.v != 0 && r.v != 0);
+            break;
+          case ast::BinaryOp::Op::BIT_AND:
+            mValue = number(li & ri);
+            break;
+          case ast::BinaryOp::Op::BIT_OR:
+            mValue = number(li | ri);
+            break;
+          case ast::BinaryOp::Op::BIT_XOR:
+            mValue = number(li ^ ri);
+            break;
+        }
+      }
+
+      virtual void visit(ast::FunctionCall* v) {
+        auto name = v->name();
+        const auto& args = v->args();
+        bool top = mDepth == 1;
+
+        if (name == "if") {
+          auto c = evaluate(args.at(0));
+          mValue = evaluate(c.v != 0 ? args.at(1) : args.at(2));
+          return;
+        }
+        if (name == "size") {
+          mValue = number(static_cast<long>(table(args.at(0)).size()));
+          return;
+        }
+        if (name == "sum" || name == "Sum") {
+          auto& t = table(args.at(0));
+          long start = 0;
+          long end = static_cast<long>(t.size()) - 1;
+          if (name == "Sum") {
+            start = std::max(0L, to_int(evaluate(args.at(1))));
+            end = std::min(end, to_int(evaluate(args.at(2))));
+          }
+          float sum = 0;
+          for (long i = start; i <= end; i++)
+            sum += t[i];
+          mValue = {sum, false};
+          return;
+        }
+
+        std::vector<Value> values;
+        for (auto a: args)
+          values.push_back(evaluate(a));
+
+        if (name == "int") {
+          mValue = number(to_int(values.at(0)));
+        } else if (name == "float") {
+          mValue = {static_cast<float>(values.at(0).v), false};
+        } else if (name == "random" && values.size() == 2) {
+          int low = static_cast<int>(to_int(values.at(0)));
+          int high = static_cast<int>(to_int({values.at(1).v - 1, false}));
+          if (top) {
+            mRandomCall = true;
+            mRandomLow = low;
+            mRandomHigh = high;
+          }
+          if (low < high) {
+            std::uniform_int_distribution<int> d(low, high);
+            mValue = number(d(mGenerator));
+          } else {
+            mValue = number(0);
+          }
+        } else if (name == "abs" && values.size() == 1 && values.at(0).integer) {
+          mValue = number(std::abs(to_int(values.at(0))));
+        } else if ((name == "min" || name == "max") && values.size() == 2 && values.at(0).integer && values.at(1).integer) {
+          auto a = to_int(values.at(0));
+          auto b = to_int(values.at(1));
+          mValue = number(name == "min" ? std::min(a, b) : std::max(a, b));
+        } else {
+          auto u = unary_functions.find(name);
+          auto b = binary_functions.find(name);
+          if (values.size() == 1 && u != unary_functions.end())
+            mValue = {static_cast<float>(u->second(values.at(0).v)), false};
+          else if (values.size() == 2 && b != binary_functions.end())
+            mValue = {static_cast<float>(b->second(values.at(0).v, values.at(1).v)), false};
+          else
+            throw std::runtime_error("the reference doesn't have the function " + name);
+        }
+      }
+
+      virtual void visit(ast::SampleAccess* v) {
+        auto index = static_cast<float>(evaluate(v->index_node()).v);
+        auto src = v->source();
+        bool output = src->type() == ast::Variable::VarType::OUTPUT;
+        float top = output ? -1.0f : 0.0f;
+        index = std::max(-static_cast<float>(mN), std::min(top, index));
+        if (std::isnan(index))
+          index = top;
+
+        auto i0 = static_cast<int>(std::floor(index));
+        float frac = index - static_cast<float>(i0);
+        float v0 = sample(src.get(), i0);
+        mValue = {frac == 0.0f ? v0 : v0 * (1.0f - frac) + sample(src.get(), std::min(i0 + 1, static_cast<int>(top))) * frac, false};
+      }
+
+      virtual void visit(ast::ArrayAccess* /*v*/) {
+        throw std::runtime_error("array access without read or write");
+      }
+
+      virtual void visit(ast::ValueAssignment* v) {
+        auto value = evaluate(v->value_node());
+        mValues[v->value_name()] = static_cast<float>(value.v);
+        mValue = {static_cast<float>(value.v), false};
+      }
+
+      virtual void visit(ast::ArrayAssignment* v) {
+        auto a = v->array();
+        auto index = evaluate(a->index_node());
+        auto value = evaluate(v->value_node());
+        auto& t = table(a.get());
+        if (t.size())
+          t[clamp(index, t.size())] = static_cast<float>(value.v);
+        mValue = {static_cast<float>(value.v), false};
+      }
+
+      virtual void visit(ast::Deref* v) {
+        auto a = std::static_pointer_cast<ast::ArrayAccess>(v->value_node());
+        auto index = evaluate(a->index_node());
+        auto& t = table(a.get());
+        mValue = {t.size() ? t[clamp(index, t.size())] : 0.0f, false};
+      }
+
+    private:
+      const harness::Kernel& mKernel;
+      int mN;
+      int mFrame = 0;
+      Value mValue = {0, false};
+      int mDepth = 0;
+
+      std::vector<float> mFloats;
+      std::vector<const float *> mVectors;
+      std::vector<std::vector<float>> mPrevious; //the last block of each vector input
+      std::vector<std::vector<float>> mOutputs;
+      std::vector<std::vector<float>> mPreviousOutputs;
+      std::map<std::string, float> mValues;
+      std::map<std::string, std::vector<float>> mTables;
+
+      std::mt19937 mGenerator;
+      bool mRandomCall = false;
+      int mRandomLow = 0;
+      int mRandomHigh = 0;
+
+      Value evaluate(const ast::NodePtr& n) {
+        mDepth++;
+        n->accept(this);
+        mDepth--;
+        return mValue;
+      }
+
+      static long to_int(const Value& v) {
+        if (!std::isfinite(v.v))
+          return 0;
+        return static_cast<long>(v.v);
+      }
+      static Value number(long v) { return {static_cast<double>(v), true}; }
+      static Value boolean(bool v) { return {v ? 1.0 : 0.0, true}; }
+
+      static size_t clamp(const Value& index, size_t size) {
+        long i = to_int(index);
+        return static_cast<size_t>(std::max(0L, std::min(static_cast<long>(size) - 1, i)));
+      }
+
+      //offset frames from the current one, 0 or less
+      float sample(ast::Variable * v, int offset) {
+        int frame = mFrame + offset;
+        auto i = v->input_index();
+        if (v->type() == ast::Variable::VarType::OUTPUT)
+          return frame >= 0 ? mOutputs.at(i).at(frame) : mPreviousOutputs.at(i).at(frame + mN);
+        return frame >= 0 ? mVectors.at(i)[frame] : mPrevious.at(i).at(frame + mN);
+      }
+
+      std::vector<float>& table(const std::string& name) {
+        auto it = mTables.find(name);
+        if (it == mTables.end())
+          return mTables[name];
+        return it->second;
+      }
+
+      std::vector<float>& table(ast::ArrayAccess * a) {
+        if (a->name().size())
+          return table(a->name());
+        return table(mSymbolName);
+      }
+
+      std::vector<float>& table(const ast::NodePtr& n) {
+        auto q = std::dynamic_pointer_cast<ast::Quoted>(n);
+        if (!q)
+          throw std::runtime_error("expected a quoted symbol");
+        return table(q->value().size() ? q->value() : mSymbolName);
+      }
+
+      //every symbol input names the test table
+      const std::string mSymbolName = table_name;
+  };
+
+  //distance in representable floats, nans only match nans
+  double ulps(float a, float b) {
+    if (std::isnan(a) || std::isnan(b))
+      return (std::isnan(a) && std::isnan(b)) ? 0 : std::numeric_limits<double>::infinity();
+    if (a == b)
+      return 0;
+    auto ordered = [](float f) {
+      int32_t i;
+      memcpy(&i, &f, sizeof(i));
+      return i < 0 ? static_cast<int64_t>(INT32_MIN) - i : static_cast<int64_t>(i);
+    };
+    return static_cast<double>(std::llabs(ordered(a) - ordered(b)));
+  }
+
+  struct Result {
+    double max_error = 0;
+    double max_ulps = 0;
+    size_t compared = 0;
+    size_t random_outside = 0;
+    bool random = false;
+    double jit_seconds = 0;
+    double reference_seconds = 0;
+  };
+
+  void set_inputs(const harness::Kernel& k, harness::Channel& c, Reference& ref, long block) {
+    size_t s = 0;
+    for (size_t i = 0; i < k.input_types.size(); i++) {
+      switch (k.input_types[i]) {
+        case ast::Variable::VarType::FLOAT:
+        case ast::Variable::VarType::INT:
+          {
+            float v = k.kind == harness::Kind::CONTROL ? control(i, block) : 2.5f + static_cast<float>(i);
+            c.inarg[i].flt = v;
+            ref.set_float(i, v);
+          }
+          break;
+        case ast::Variable::VarType::SYMBOL:
+          c.inarg[i].sym = gensym(table_name.c_str());
+          break;
+        case ast::Variable::VarType::VECTOR:
+        case ast::Variable::VarType::INPUT:
+          {
+            auto v = c.signals.at(s++);
+            for (int f = 0; f < c.n; f++)
+              v[f] = wave(i, block * c.n + f);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  Result compare(const harness::Kernel& k, int n, int blocks, bool inplace, double duration) {
+    pdstub_table(table_name, table_contents());
+
+    Result result;
+    harness::Channel c(k, n, inplace);
+    Reference ref(k, n);
+
+    std::vector<bool> random;
+    for (auto t: k.trees) {
+      RandomVisitor v;
+      t->accept(&v);
+      random.push_back(v.found);
+      result.random = result.random || v.found;
+    }
+
+    //the reference reads its own copy as the kernel may write over its inputs
+    std::vector<std::vector<float>> inputs(k.input_types.size(), std::vector<float>(n));
+    std::vector<std::vector<float>> outputs(k.outputs, std::vector<float>(n));
+    for (long b = 0; b < blocks; b++) {
+      set_inputs(k, c, ref, b);
+      size_t s = 0;
+      for (size_t i = 0; i < k.input_types.size(); i++) {
+        auto t = k.input_types[i];
+        if (t != ast::Variable::VarType::VECTOR && t != ast::Variable::VarType::INPUT)
+          continue;
+        auto v = c.signals.at(s++);
+        std::copy(v, v + n, inputs[i].begin());
+        ref.set_vector(i, inputs[i].data());
+      }
+
+      c.perform(k);
+      for (size_t o = 0; o < k.outputs; o++)
+        std::copy(c.outarg[o], c.outarg[o] + n, outputs[o].begin());
+
+      for (int f = 0; f < n; f++) {
+        for (size_t o = 0; o < k.outputs; o++) {
+          float expected = ref.evaluate(o, f);
+          float actual = outputs[o][f];
+          if (random[o]) {
+            if (ref.random_call()) {
+              int low = ref.random_low();
+              int high = ref.random_high();
+              bool inside = low < high ? (actual == std::trunc(actual) && actual >= low && actual <= high) : actual == 0.0f;
+              result.random_outside += inside ? 0 : 1;
+            }
+            ref.set_output(o, f, actual);
+            continue;
+          }
+          result.compared++;
+          result.max_ulps = std::max(result.max_ulps, ulps(expected, actual));
+          double error = std::fabs(static_cast<double>(expected) - static_cast<double>(actual));
+          if (std::isnan(error))
+            error = (std::isnan(expected) && std::isnan(actual)) ? 0 : std::numeric_limits<double>::infinity();
+          result.max_error = std::max(result.max_error, error);
+        }
+      }
+      ref.next_block();
+    }
+
+    //the same inputs over and over for the timing
+    auto start = timer::now();
+    long runs = 0;
+    do {
+      c.perform(k);
+      runs++;
+    } while (std::chrono::duration<double>(timer::now() - start).count() < duration);
+    result.jit_seconds = std::chrono::duration<double>(timer::now() - start).count() / (runs * n);
+
+    start = timer::now();
+    runs = 0;
+    do {
+      for (int f = 0; f < n; f++)
+        for (size_t o = 0; o < k.outputs; o++)
+          ref.evaluate(o, f);
+      runs++;
+    } while (std::chrono::duration<double>(timer::now() - start).count() < duration);
+    result.reference_seconds = std::chrono::duration<double>(timer::now() - start).count() / (runs * n);
+    return result;
+  }
+
+  void usage() {
+    cerr << "usage: exprdiff [-block n] [-blocks n] [-ulp n] [-seconds s] [-inplace] [-cpu name] [-fastmath] "
+      "[-accuracy precise|fast|libm] [-f file] [expression]..." << endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char * argv[]) {
+  int block = 64;
+  int blocks = 8;
+  double max_ulps = 4;
+  double duration = 0.1;
+  bool inplace = false;
+  xnor::CompileOptions options;
+  std::vector<std::string> lines;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-block" && i + 1 < argc) {
+      block = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-blocks" && i + 1 < argc) {
+      blocks = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-ulp" && i + 1 < argc) {
+      max_ulps = atof(argv[++i]);
+    } else if (arg == "-seconds" && i + 1 < argc) {
+      duration = atof(argv[++i]);
+    } else if (arg == "-inplace") {
+      inplace = true;
+    } else if (arg == "-cpu" && i + 1 < argc) {
+      options.cpu = argv[++i];
+    } else if (arg == "-fastmath") {
+      options.fastmath = true;
+    } else if (arg == "-accuracy" && i + 1 < argc) {
+      if (!xnor::MathLibrary::parse(argv[++i], options.accuracy))
+        usage();
+    } else if (arg == "-f" && i + 1 < argc) {
+      std::ifstream in(argv[++i]);
+      if (!in) {
+        cerr << "cannot open " << argv[i] << endl;
+        return 1;
+      }
+      std::string line;
+      while (std::getline(in, line))
+        if (line.find_first_not_of(" \t") != std::string::npos)
+          lines.push_back(line);
+    } else if (arg.size() && arg[0] == '-') {
+      usage();
+    } else {
+      lines.push_back(arg);
+    }
+  }
+  if (lines.empty())
+    usage();
+
+  xnor::LLVMCodeGenVisitor::init();
+  try {
+    xnor::JIT::instance().targetMachine(options.cpu);
+  } catch (std::runtime_error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  printf("%9s %12s %10s  %-16s expression\n", "speedup", "max error", "max ulps", "flags");
+  int flagged = 0;
+  int failures = 0;
+  for (auto& line: lines) {
+    harness::Expression e;
+    harness::Kernel k;
+    Result r;
+    try {
+      e = harness::expression(line);
+      k = harness::compile(e, options);
+      r = compare(k, e.kind == harness::Kind::CONTROL ? 1 : block, e.kind == harness::Kind::CONTROL ? blocks * block : blocks, inplace, duration);
+    } catch (std::runtime_error& err) {
+      cerr << "fail: " << line << ": " << err.what() << endl;
+      harness::release(k);
+      failures++;
+      continue;
+    }
+    harness::release(k);
+
+    double speedup = r.reference_seconds / r.jit_seconds;
+    std::string flags;
+    if (speedup < 1.0)
+      flags += "slower ";
+    if (r.max_ulps > max_ulps || r.random_outside)
+      flags += "diverges ";
+    if (r.random)
+      flags += "random ";
+    if (flags.size())
+      flagged++;
+
+    printf("%9.2f %12.4g %10.0f  %-16s %s%s\n", speedup, r.max_error, r.max_ulps, flags.c_str(),
+        harness::name(e.kind).c_str(), e.source.c_str());
+  }
+
+  printf("\n%zu expressions, %d flagged, %d failed\n", lines.size(), flagged, failures);
+  return (flagged || failures) ? 2 : 0;
+}
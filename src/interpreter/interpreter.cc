@@ -0,0 +1,448 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "interpreter.h"
+#include "runtime.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+namespace ast = xnor::ast;
+using Op = xnor::Interpreter::Op;
+using Instruction = xnor::Interpreter::Instruction;
+
+namespace {
+  //nan and values out of range give INT_MIN like cvttss2si, the cast alone would be undefined
+  inline int to_int(float v) {
+    return (v >= -2147483648.0f && v < 2147483648.0f) ? static_cast<int>(v) : std::numeric_limits<int>::min();
+  }
+
+  //the same functions LLVMCodeGenVisitor calls, by expression name
+  const std::map<std::string, float (*)(float)> unary_functions = {
+    {"abs", [](float v) { return std::fabs(v); }},
+    {"acos", [](float v) { return std::acos(v); }},
+    {"acosh", [](float v) { return std::acosh(v); }},
+    {"asin", [](float v) { return std::asin(v); }},
+    {"asinh", [](float v) { return std::asinh(v); }},
+    {"atanh", [](float v) { return std::atanh(v); }},
+    {"cbrt", [](float v) { return std::cbrt(v); }},
+    {"ceil", [](float v) { return std::ceil(v); }},
+    {"cos", [](float v) { return std::cos(v); }},
+    {"erf", [](float v) { return std::erf(v); }},
+    {"erfc", [](float v) { return std::erfc(v); }},
+    {"exp", [](float v) { return std::exp(v); }},
+    {"expm1", [](float v) { return std::expm1(v); }},
+    {"fact", jit_expr_fact},
+    {"finite", jit_expr_finite},
+    {"floor", [](float v) { return std::floor(v); }},
+    {"imodf", jit_expr_imodf},
+    {"isinf", jit_expr_isinf},
+    {"isnan", jit_expr_isnan},
+    {"ln", [](float v) { return std::log(v); }},
+    {"log", [](float v) { return std::log(v); }},
+    {"log10", [](float v) { return std::log10(v); }},
+    {"log1p", [](float v) { return std::log1p(v); }},
+    {"modf", jit_expr_modf},
+    {"nearbyint", [](float v) { return std::nearbyint(v); }},
+    {"rint", [](float v) { return std::rint(v); }},
+    {"round", [](float v) { return std::round(v); }},
+    {"sin", [](float v) { return std::sin(v); }},
+    {"sqrt", [](float v) { return std::sqrt(v); }},
+    {"tan", [](float v) { return std::tan(v); }},
+    {"tanh", [](float v) { return std::tanh(v); }},
+    {"trunc", [](float v) { return std::trunc(v); }},
+  };
+
+  const std::map<std::string, float (*)(float, float)> binary_functions = {
+    {"atan2", [](float a, float b) { return std::atan2(a, b); }},
+    {"copysign", [](float a, float b) { return std::copysign(a, b); }},
+    {"fmod", [](float a, float b) { return std::fmod(a, b); }},
+    {"ldexp", [](float a, float b) { return std::ldexp(a, to_int(b)); }},
+    {"max", jit_expr_max},
+    {"min", jit_expr_min},
+    {"pow", [](float a, float b) { return std::pow(a, b); }},
+    {"random", jit_expr_random},
+    {"remainder", [](float a, float b) { return std::remainder(a, b); }},
+  };
+
+  const std::map<ast::BinaryOp::Op, Op> binary_ops = {
+    {ast::BinaryOp::Op::ADD, Op::ADD},
+    {ast::BinaryOp::Op::SUBTRACT, Op::SUBTRACT},
+    {ast::BinaryOp::Op::MULTIPLY, Op::MULTIPLY},
+    {ast::BinaryOp::Op::DIVIDE, Op::DIVIDE},
+    {ast::BinaryOp::Op::MOD, Op::MOD},
+    {ast::BinaryOp::Op::SHIFT_LEFT, Op::SHIFT_LEFT},
+    {ast::BinaryOp::Op::SHIFT_RIGHT, Op::SHIFT_RIGHT},
+    {ast::BinaryOp::Op::COMP_EQUAL, Op::COMP_EQUAL},
+    {ast::BinaryOp::Op::COMP_NOT_EQUAL, Op::COMP_NOT_EQUAL},
+    {ast::BinaryOp::Op::COMP_GREATER, Op::COMP_GREATER},
+    {ast::BinaryOp::Op::COMP_LESS, Op::COMP_LESS},
+    {ast::BinaryOp::Op::COMP_GREATER_OR_EQUAL, Op::COMP_GREATER_OR_EQUAL},
+    {ast::BinaryOp::Op::COMP_LESS_OR_EQUAL, Op::COMP_LESS_OR_EQUAL},
+    {ast::BinaryOp::Op::LOGICAL_OR, Op::LOGICAL_OR},
+    {ast::BinaryOp::Op::LOGICAL_AND, Op::LOGICAL_AND},
+    {ast::BinaryOp::Op::BIT_AND, Op::BIT_AND},
+    {ast::BinaryOp::Op::BIT_OR, Op::BIT_OR},
+    {ast::BinaryOp::Op::BIT_XOR, Op::BIT_XOR},
+  };
+
+  class BytecodeVisitor : public ast::Visitor {
+    public:
+      BytecodeVisitor(std::vector<Instruction>& code) : mCode(code) { }
+
+      int max_depth() const { return mMaxDepth; }
+
+      void statement(ast::NodePtr n, int index) {
+        n->accept(this);
+        emit(Op::STORE, -1).arg = index;
+      }
+
+      virtual void visit(ast::Variable* v) {
+        switch (v->type()) {
+          case ast::Variable::VarType::FLOAT:
+            emit(Op::INPUT_FLOAT, 1).arg = v->input_index();
+            break;
+          case ast::Variable::VarType::INT:
+            emit(Op::INPUT_INT, 1).arg = v->input_index();
+            break;
+          case ast::Variable::VarType::VECTOR:
+            emit(Op::INPUT_VECTOR, 1).arg = v->input_index();
+            break;
+          default:
+            throw std::runtime_error("variable type cannot be used as a value");
+        }
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::Value<int>* v) {
+        emit(Op::PUSH, 1).value = static_cast<float>(v->value());
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::Value<float>* v) {
+        emit(Op::PUSH, 1).value = v->value();
+      }
+
+      virtual void visit(ast::Value<std::string>* v) {
+        emit(Op::VALUE_GET, 1).sym = gensym(v->value().c_str());
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::Quoted* /*v*/) {
+        throw std::runtime_error("quoted values can only be function arguments");
+      }
+
+      virtual void visit(ast::UnaryOp* v) {
+        v->node()->accept(this);
+        switch (v->op()) {
+          case ast::UnaryOp::Op::BIT_NOT:
+            emit(Op::BIT_NOT, 0);
+            break;
+          case ast::UnaryOp::Op::LOGICAL_NOT:
+            emit(Op::LOGICAL_NOT, 0);
+            break;
+          case ast::UnaryOp::Op::NEGATE:
+            emit(Op::NEGATE, 0);
+            break;
+        }
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::BinaryOp* v) {
+        v->left()->accept(this);
+        v->right()->accept(this);
+        auto it = binary_ops.find(v->op());
+        if (it == binary_ops.end())
+          throw std::runtime_error("not supported yet");
+        emit(it->second, -1);
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::FunctionCall* v) {
+        auto n = v->name();
+        const auto& args = v->args();
+
+        if (n == "if") {
+          args.at(0)->accept(this);
+          size_t jz = mCode.size();
+          emit(Op::JUMP_IF_ZERO, -1);
+
+          args.at(1)->accept(this);
+          size_t jmp = mCode.size();
+          emit(Op::JUMP, 0);
+          mDepth--; //only one of the branches ends up on the stack
+
+          mCode.at(jz).arg = static_cast<int>(mCode.size());
+          args.at(2)->accept(this);
+          mCode.at(jmp).arg = static_cast<int>(mCode.size());
+        } else if (n == "float") {
+          args.at(0)->accept(this);
+          return;
+        } else if (n == "int") {
+          args.at(0)->accept(this);
+        } else if (n == "size") {
+          symbol(emit(Op::TABLE_SIZE, 1), args.at(0));
+        } else if (n == "sum") {
+          symbol(emit(Op::TABLE_SUM_ALL, 1), args.at(0));
+        } else if (n == "Sum") {
+          args.at(1)->accept(this);
+          args.at(2)->accept(this);
+          symbol(emit(Op::TABLE_SUM, -1), args.at(0));
+        } else {
+          for (auto a: args)
+            a->accept(this);
+          auto u = unary_functions.find(n);
+          auto b = binary_functions.find(n);
+          if (args.size() == 1 && u != unary_functions.end()) {
+            emit(Op::CALL1, 0).func1 = u->second;
+          } else if (args.size() == 2 && b != binary_functions.end()) {
+            emit(Op::CALL2, -1).func2 = b->second;
+          } else {
+            throw std::runtime_error("cannot find function with name: " + n);
+          }
+        }
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::SampleAccess* v) {
+        v->index_node()->accept(this);
+        auto src = v->source();
+        auto op = src->type() == ast::Variable::VarType::OUTPUT ? Op::SAMPLE_OUTPUT : Op::SAMPLE_INPUT;
+        emit(op, 0).arg = src->input_index();
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::ArrayAccess* /*v*/) {
+        throw std::runtime_error("array access without read or write");
+      }
+
+      virtual void visit(ast::ValueAssignment* v) {
+        v->value_node()->accept(this);
+        emit(Op::VALUE_ASSIGN, 0).sym = gensym(v->value_name().c_str());
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::ArrayAssignment* v) {
+        auto a = v->array();
+        a->index_node()->accept(this);
+        v->value_node()->accept(this);
+        table(emit(Op::TABLE_WRITE, -1), a.get());
+        wrapIntIfNeeded(v);
+      }
+
+      virtual void visit(ast::Deref* v) {
+        auto a = std::static_pointer_cast<ast::ArrayAccess>(v->value_node());
+        a->index_node()->accept(this);
+        table(emit(Op::TABLE_READ, 0), a.get());
+        wrapIntIfNeeded(v);
+      }
+
+    private:
+      std::vector<Instruction>& mCode;
+      int mDepth = 0;
+      int mMaxDepth = 0;
+
+      //stack is the change in stack depth the instruction causes
+      Instruction& emit(Op op, int stack) {
+        Instruction i;
+        i.op = op;
+        mCode.push_back(i);
+        mDepth += stack;
+        mMaxDepth = std::max(mMaxDepth, mDepth);
+        return mCode.back();
+      }
+
+      void wrapIntIfNeeded(ast::Node * n) {
+        if (n->output_type() == ast::Node::OutputType::INT)
+          emit(Op::WRAP_INT, 0);
+      }
+
+      void symbol(Instruction& i, ast::NodePtr n) {
+        auto q = std::dynamic_pointer_cast<ast::Quoted>(n);
+        if (!q)
+          throw std::runtime_error("expected a quoted symbol");
+        if (q->value().size())
+          i.sym = gensym(q->value().c_str());
+        else
+          i.arg = q->variable()->input_index();
+      }
+
+      void table(Instruction& i, ast::ArrayAccess * a) {
+        if (a->name().size())
+          i.sym = gensym(a->name().c_str());
+        else
+          i.arg = a->name_var()->input_index();
+      }
+  };
+
+  inline float wrap_logic(bool v) { return v ? 1.0f : 0.0f; }
+  //bitwise results are converted as unsigned, like the generated code does
+  inline float from_bits(int v) { return static_cast<float>(static_cast<uint32_t>(v)); }
+  //ordered not equal, false for nan
+  inline bool is_true(float v) { return v < 0.0f || v > 0.0f; }
+}
+
+namespace xnor {
+  Interpreter::Interpreter(const std::vector<ast::NodePtr>& statements) {
+    BytecodeVisitor v(mCode);
+    for (size_t i = 0; i < statements.size(); i++)
+      v.statement(statements.at(i), static_cast<int>(i));
+    mStack.resize(std::max(1, v.max_depth()));
+
+    //outputs that are read are saved after the outputs, like the generated code does
+    mOutputCount = static_cast<int>(statements.size());
+    mSavedOutputs.resize(statements.size(), false);
+    for (auto& i: mCode) {
+      if (i.op == Op::SAMPLE_OUTPUT)
+        mSavedOutputs.at(i.arg) = true;
+    }
+  }
+
+  void Interpreter::run(float ** out, LLVMCodeGenVisitor::input_arg_t * in, int nframes) {
+    const Instruction * code = mCode.data();
+    const size_t length = mCode.size();
+    float * stack = mStack.data();
+
+    for (int frame = 0; frame < nframes; frame++) {
+      float * sp = stack; //next free slot
+      size_t pc = 0;
+      while (pc < length) {
+        const Instruction& i = code[pc++];
+        switch (i.op) {
+          case Op::PUSH:
+            *sp++ = i.value;
+            break;
+          case Op::INPUT_FLOAT:
+            *sp++ = in[i.arg].flt;
+            break;
+          case Op::INPUT_INT:
+            *sp++ = std::floor(in[i.arg].flt);
+            break;
+          case Op::INPUT_VECTOR:
+            *sp++ = in[i.arg].vec[frame];
+            break;
+          case Op::SAMPLE_INPUT:
+          case Op::SAMPLE_OUTPUT:
+            {
+              //clamp between -nframes and top and offset by the frame and the previous block,
+              //saved outputs hold the previous block past the current frame
+              bool output = i.op == Op::SAMPLE_OUTPUT;
+              float * current = output ? out[mOutputCount + i.arg] : in[i.arg].history[0];
+              float * previous = output ? current : in[i.arg].history[1];
+              float top = output ? -1.0f : 0.0f;
+              float bottom = 0.0f - static_cast<float>(nframes);
+              float index = sp[-1];
+              index = index < top ? index : top;
+              index = index < bottom ? bottom : index;
+              index = index + static_cast<float>(frame + nframes);
+              int i0 = static_cast<int>(index);
+              int i1 = std::min(i0 + 1, nframes * 2 - 1);
+              float frac = index - static_cast<float>(i0);
+              float v0 = i0 < nframes ? previous[i0] : current[i0 - nframes];
+              float v1 = i1 < nframes ? previous[i1] : current[i1 - nframes];
+              sp[-1] = v1 * frac + v0 * (1.0f - frac);
+            }
+            break;
+          case Op::WRAP_INT:
+            sp[-1] = static_cast<float>(to_int(sp[-1]));
+            break;
+          case Op::NEGATE:
+            sp[-1] = 0.0f - sp[-1];
+            break;
+          case Op::BIT_NOT:
+            sp[-1] = static_cast<float>(~to_int(sp[-1]));
+            break;
+          case Op::LOGICAL_NOT:
+            sp[-1] = wrap_logic(sp[-1] == 0.0f);
+            break;
+          case Op::CALL1:
+            sp[-1] = i.func1(sp[-1]);
+            break;
+          case Op::CALL2:
+            sp--;
+            sp[-1] = i.func2(sp[-1], sp[0]);
+            break;
+          case Op::JUMP:
+            pc = i.arg;
+            break;
+          case Op::JUMP_IF_ZERO:
+            if (!is_true(*--sp))
+              pc = i.arg;
+            break;
+          case Op::VALUE_GET:
+            *sp++ = jit_expr_value_get(i.sym ? i.sym : in[i.arg].sym);
+            break;
+          case Op::VALUE_ASSIGN:
+            sp[-1] = jit_expr_value_assign(i.sym ? i.sym : in[i.arg].sym, sp[-1]);
+            break;
+          case Op::TABLE_READ:
+            sp[-1] = jit_expr_deref(jit_expr_table_value_ptr(i.sym ? i.sym : in[i.arg].sym, sp[-1]));
+            break;
+          case Op::TABLE_WRITE:
+            {
+              sp--;
+              float * p = jit_expr_table_value_ptr(i.sym ? i.sym : in[i.arg].sym, sp[-1]);
+              if (p)
+                *p = sp[0];
+              sp[-1] = sp[0];
+            }
+            break;
+          case Op::TABLE_SIZE:
+            *sp++ = jit_expr_table_size(i.sym ? i.sym : in[i.arg].sym);
+            break;
+          case Op::TABLE_SUM:
+            sp--;
+            sp[-1] = jit_expr_table_sum(i.sym ? i.sym : in[i.arg].sym, sp[-1], sp[0]);
+            break;
+          case Op::TABLE_SUM_ALL:
+            *sp++ = jit_expr_table_sum_all(i.sym ? i.sym : in[i.arg].sym);
+            break;
+          case Op::STORE:
+            out[i.arg][frame] = *--sp;
+            if (mSavedOutputs[i.arg])
+              out[mOutputCount + i.arg][frame] = *sp;
+            break;
+          default:
+            {
+              //binary operators
+              sp--;
+              float l = sp[-1];
+              float r = sp[0];
+              float v = 0.0f;
+              switch (i.op) {
+                case Op::ADD: v = l + r; break;
+                case Op::SUBTRACT: v = l - r; break;
+                case Op::MULTIPLY: v = l * r; break;
+                case Op::DIVIDE: v = l / r; break;
+                case Op::MOD:
+                  {
+                    int ir = to_int(r);
+                    v = is_true(static_cast<float>(ir)) ? static_cast<float>(to_int(l) % ir) : 0.0f;
+                  }
+                  break;
+                case Op::SHIFT_LEFT: v = static_cast<float>(static_cast<int>(static_cast<uint32_t>(to_int(l)) << (to_int(r) & 31))); break;
+                case Op::SHIFT_RIGHT: v = static_cast<float>(static_cast<int>(static_cast<uint32_t>(to_int(l)) >> (to_int(r) & 31))); break;
+                case Op::COMP_EQUAL: v = wrap_logic(l == r); break;
+                case Op::COMP_NOT_EQUAL: v = wrap_logic(l < r || l > r); break;
+                case Op::COMP_GREATER: v = wrap_logic(l > r); break;
+                case Op::COMP_LESS: v = wrap_logic(l < r); break;
+                case Op::COMP_GREATER_OR_EQUAL: v = wrap_logic(!(l < r)); break;
+                case Op::COMP_LESS_OR_EQUAL: v = wrap_logic(!(l > r)); break;
+                case Op::LOGICAL_OR: v = wrap_logic((to_int(l) | to_int(r)) != 0); break;
+                case Op::LOGICAL_AND: v = wrap_logic((to_int(l) & to_int(r)) != 0); break;
+                case Op::BIT_AND: v = from_bits(to_int(l) & to_int(r)); break;
+                case Op::BIT_OR: v = from_bits(to_int(l) | to_int(r)); break;
+                case Op::BIT_XOR: v = from_bits(to_int(l) ^ to_int(r)); break;
+                default: break;
+              }
+              sp[-1] = v;
+            }
+            break;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,85 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include "ast.h"
+#include "llvmcodegen/codegen.h"
+#include <m_pd.h>
+#include <string>
+#include <vector>
+
+namespace xnor {
+  //evaluates statements without llvm so objects can run as soon as they're created.
+  //the trees are flattened into a compact stack based bytecode that follows the
+  //semantics of the code LLVMCodeGenVisitor generates
+  class Interpreter {
+    public:
+      enum class Op : unsigned char {
+        PUSH,
+        INPUT_FLOAT,
+        INPUT_INT,
+        INPUT_VECTOR,
+        SAMPLE_INPUT,
+        SAMPLE_OUTPUT,
+        WRAP_INT,
+
+        NEGATE,
+        BIT_NOT,
+        LOGICAL_NOT,
+
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        MOD,
+        SHIFT_LEFT,
+        SHIFT_RIGHT,
+        COMP_EQUAL,
+        COMP_NOT_EQUAL,
+        COMP_GREATER,
+        COMP_LESS,
+        COMP_GREATER_OR_EQUAL,
+        COMP_LESS_OR_EQUAL,
+        LOGICAL_OR,
+        LOGICAL_AND,
+        BIT_AND,
+        BIT_OR,
+        BIT_XOR,
+
+        CALL1,
+        CALL2,
+        JUMP,
+        JUMP_IF_ZERO,
+
+        VALUE_GET,
+        VALUE_ASSIGN,
+        TABLE_READ,
+        TABLE_WRITE,
+        TABLE_SIZE,
+        TABLE_SUM,
+        TABLE_SUM_ALL,
+
+        STORE
+      };
+
+      struct Instruction {
+        Op op;
+        int arg = 0; //input, output or statement index, or jump target
+        float value = 0; //constant
+        t_symbol * sym = nullptr; //constant symbol, if null the symbol comes from input arg
+        float (*func1)(float) = nullptr;
+        float (*func2)(float, float) = nullptr;
+      };
+
+      //throws std::runtime_error if the statements can't be interpreted
+      Interpreter(const std::vector<xnor::ast::NodePtr>& statements);
+
+      //same arguments as LLVMCodeGenVisitor::function_t
+      void run(float ** out, LLVMCodeGenVisitor::input_arg_t * in, int nframes);
+    private:
+      std::vector<Instruction> mCode;
+      std::vector<float> mStack;
+      int mOutputCount = 0;
+      std::vector<bool> mSavedOutputs; //outputs that are read with $y
+  };
+}
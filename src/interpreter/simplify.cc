@@ -0,0 +1,265 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "simplify.h"
+#include "interpreter.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace ast = xnor::ast;
+
+namespace {
+  using ot = ast::Node::OutputType;
+
+  bool constant(const ast::NodePtr& n, float& value) {
+    if (auto v = std::dynamic_pointer_cast<ast::Value<float>>(n)) {
+      value = v->value();
+      return true;
+    }
+    if (auto v = std::dynamic_pointer_cast<ast::Value<int>>(n)) {
+      value = static_cast<float>(v->value());
+      return true;
+    }
+    return false;
+  }
+
+  bool constant(const ast::NodePtr& n) {
+    float value;
+    return constant(n, value);
+  }
+
+  bool is(const ast::NodePtr& n, float value) {
+    float v;
+    return constant(n, v) && v == value;
+  }
+
+  //converting nan or anything out of range to an int is undefined, those are left for run time
+  bool representable(float value, ot type) {
+    return type != ot::INT || (value >= -2147483648.0f && value < 2147483648.0f);
+  }
+
+  ast::NodePtr number(float value, ot type) {
+    if (type == ot::INT)
+      return std::make_shared<ast::Value<int>>(static_cast<int>(value), ot::INT);
+    return std::make_shared<ast::Value<float>>(value);
+  }
+
+  //parents compute differently with int children, so a replacement keeps the type of the node it replaces
+  ast::NodePtr retype(const ast::NodePtr& n, ot type) {
+    if (n->output_type() == type)
+      return n;
+    float value;
+    if (constant(n, value) && representable(value, type))
+      return number(value, type);
+    return std::make_shared<ast::FunctionCall>(type == ot::INT ? "int" : "float", std::vector<ast::NodePtr>{n});
+  }
+
+  //evaluate a node that only has constant children, false if the interpreter can't
+  bool evaluate(const ast::NodePtr& n, float& value) {
+    try {
+      xnor::Interpreter interpreter({n});
+      float * out = &value;
+      interpreter.run(&out, nullptr, 1);
+      return true;
+    } catch (std::runtime_error& /*e*/) {
+      return false;
+    }
+  }
+
+  //nodes that are cheap to compute twice, the interpreter and codegen walk trees so a
+  //repeated subtree is computed again each time it appears
+  bool leaf(const ast::NodePtr& n) {
+    if (std::dynamic_pointer_cast<ast::Variable>(n) || constant(n))
+      return true;
+    auto s = std::dynamic_pointer_cast<ast::SampleAccess>(n);
+    return s && constant(s->index_node());
+  }
+
+  //c where x / c is exactly x * (1 / c)
+  bool exact_reciprocal(float c) {
+    int exp = 0;
+    if (!std::isfinite(c) || std::frexp(c, &exp) != 0.5f)
+      return false;
+    float r = 1.0f / c;
+    return std::isnormal(r) && 1.0f / r == c;
+  }
+
+  class SimplifyVisitor : public ast::Visitor {
+    public:
+      SimplifyVisitor(xnor::MathLibrary::Accuracy accuracy) : mAccuracy(accuracy) { }
+
+      ast::NodePtr simplify(const ast::NodePtr& n) {
+        auto node = mNode;
+        mNode = n;
+        n->accept(this);
+        mNode = node;
+        return mResult;
+      }
+
+      virtual void visit(ast::Variable* /*v*/) { mResult = mNode; }
+      virtual void visit(ast::Value<int>* /*v*/) { mResult = mNode; }
+      virtual void visit(ast::Value<float>* /*v*/) { mResult = mNode; }
+      virtual void visit(ast::Value<std::string>* /*v*/) { mResult = mNode; }
+      virtual void visit(ast::Quoted* /*v*/) { mResult = mNode; }
+
+      virtual void visit(ast::UnaryOp* v) {
+        auto node = simplify(v->node());
+        if (v->op() == ast::UnaryOp::Op::NEGATE) {
+          auto inner = std::dynamic_pointer_cast<ast::UnaryOp>(node);
+          if (inner && inner->op() == ast::UnaryOp::Op::NEGATE) {
+            mResult = retype(inner->node(), v->output_type());
+            return;
+          }
+        }
+        fold(node == v->node() ? mNode : std::make_shared<ast::UnaryOp>(v->op(), node), {node});
+      }
+
+      virtual void visit(ast::BinaryOp* v) {
+        auto left = simplify(v->left());
+        auto right = simplify(v->right());
+        auto type = v->output_type();
+
+        if (!constant(left) || !constant(right)) {
+          ast::NodePtr result = nullptr;
+          switch (v->op()) {
+            case ast::BinaryOp::Op::ADD:
+              if (is(right, 0.0f))
+                result = left;
+              else if (is(left, 0.0f))
+                result = right;
+              break;
+            case ast::BinaryOp::Op::SUBTRACT:
+              if (is(right, 0.0f))
+                result = left;
+              break;
+            case ast::BinaryOp::Op::MULTIPLY:
+              if (is(right, 1.0f))
+                result = left;
+              else if (is(left, 1.0f))
+                result = right;
+              break;
+            case ast::BinaryOp::Op::DIVIDE:
+              {
+                float c = 0;
+                if (is(right, 1.0f))
+                  result = left;
+                else if (constant(right, c) && exact_reciprocal(c))
+                  result = std::make_shared<ast::BinaryOp>(left, ast::BinaryOp::Op::MULTIPLY, number(1.0f / c, ot::FLOAT));
+              }
+              break;
+            default:
+              break;
+          }
+          if (result) {
+            mResult = retype(result, type);
+            return;
+          }
+        }
+
+        if (left == v->left() && right == v->right())
+          fold(mNode, {left, right});
+        else
+          fold(std::make_shared<ast::BinaryOp>(left, v->op(), right), {left, right});
+      }
+
+      virtual void visit(ast::FunctionCall* v) {
+        auto name = v->name();
+        auto type = v->output_type();
+        std::vector<ast::NodePtr> args;
+        bool changed = false;
+        for (auto a: v->args()) {
+          args.push_back(simplify(a));
+          changed = changed || args.back() != a;
+        }
+
+        float c = 0;
+        if (name == "if" && constant(args.at(0), c)) {
+          //nan is false, like the generated code
+          mResult = retype((c < 0.0f || c > 0.0f) ? args.at(1) : args.at(2), type);
+          return;
+        }
+        if ((name == "int" && args.at(0)->output_type() == ot::INT) ||
+            (name == "float" && args.at(0)->output_type() == ot::FLOAT)) {
+          mResult = args.at(0);
+          return;
+        }
+        if (name == "pow" && !constant(args.at(0)) && constant(args.at(1), c)) {
+          if (c == 1.0f) {
+            mResult = retype(args.at(0), type);
+            return;
+          }
+          //anything bigger stays a pow so it is only computed once
+          if (c == 2.0f && leaf(args.at(0))) {
+            mResult = retype(std::make_shared<ast::BinaryOp>(args.at(0), ast::BinaryOp::Op::MULTIPLY, args.at(0)), type);
+            return;
+          }
+        }
+
+        auto n = changed ? std::make_shared<ast::FunctionCall>(name, args) : mNode;
+        if (ast::impure_functions.count(name) || xnor::MathLibrary::approximates(name, mAccuracy))
+          mResult = n;
+        else
+          fold(n, args);
+      }
+
+      virtual void visit(ast::SampleAccess* v) {
+        auto index = simplify(v->index_node());
+        mResult = index == v->index_node() ? mNode : std::make_shared<ast::SampleAccess>(v->source(), index);
+      }
+
+      virtual void visit(ast::ArrayAccess* v) {
+        auto index = simplify(v->index_node());
+        if (index == v->index_node())
+          mResult = mNode;
+        else if (v->name_var())
+          mResult = std::make_shared<ast::ArrayAccess>(v->name_var(), index);
+        else
+          mResult = std::make_shared<ast::ArrayAccess>(v->name(), index);
+      }
+
+      virtual void visit(ast::ValueAssignment* v) {
+        auto value = simplify(v->value_node());
+        mResult = value == v->value_node() ? mNode : std::make_shared<ast::ValueAssignment>(v->value_name(), value);
+      }
+
+      virtual void visit(ast::ArrayAssignment* v) {
+        auto array = std::static_pointer_cast<ast::ArrayAccess>(simplify(v->array()));
+        auto value = simplify(v->value_node());
+        if (array == v->array() && value == v->value_node())
+          mResult = mNode;
+        else
+          mResult = std::make_shared<ast::ArrayAssignment>(array, value);
+      }
+
+      virtual void visit(ast::Deref* v) {
+        auto array = std::static_pointer_cast<ast::ArrayAccess>(simplify(v->value_node()));
+        mResult = array == v->value_node() ? mNode : std::make_shared<ast::Deref>(array);
+      }
+    private:
+      xnor::MathLibrary::Accuracy mAccuracy;
+      ast::NodePtr mNode = nullptr;
+      ast::NodePtr mResult = nullptr;
+
+      //replace n with its value if all of its children are constant
+      void fold(const ast::NodePtr& n, const std::vector<ast::NodePtr>& children) {
+        mResult = n;
+        for (auto c: children) {
+          if (!constant(c))
+            return;
+        }
+        float value = 0;
+        if (evaluate(n, value) && representable(value, n->output_type()))
+          mResult = number(value, n->output_type());
+      }
+  };
+}
+
+namespace xnor {
+  std::vector<ast::NodePtr> simplify(const std::vector<ast::NodePtr>& trees, MathLibrary::Accuracy accuracy) {
+    SimplifyVisitor v(accuracy);
+    std::vector<ast::NodePtr> simplified;
+    for (auto t: trees)
+      simplified.push_back(v.simplify(t));
+    return simplified;
+  }
+}
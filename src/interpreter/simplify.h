@@ -0,0 +1,16 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include "ast.h"
+#include "llvmcodegen/mathlib.h"
+#include <vector>
+
+namespace xnor {
+  //returns the trees with constant subtrees folded and some algebra applied, like x * 1 to x,
+  //x / 4 to x * 0.25, pow(x, 2) to x * x and an if with a constant condition to one of its branches.
+  //constants are folded with the Interpreter so they get the same values it computes, and nodes
+  //keep their int or float output type. functions the kernel computes with polynomials at this
+  //accuracy are left for the kernel, and so are int results that don't fit in an int
+  std::vector<ast::NodePtr> simplify(const std::vector<ast::NodePtr>& trees, MathLibrary::Accuracy accuracy);
+}
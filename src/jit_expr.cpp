@@ -9,18 +9,17 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
-#include <random>
 #include <cmath>
+#include <climits>
 #include "llvmcodegen/codegen.h"
+#include "llvmcodegen/kernel.h"
+#include "interpreter/interpreter.h"
+#include "interpreter/simplify.h"
 #include "parser.hh"
+#include "runtime.h"
+#include "cycles.h"
 #include "jit_expr_version.h"
 
-#if defined (_MSC_VER)  // Visual studio
-    #define thread_local __declspec( thread )
-#elif defined (__GCC__) // GCC
-    #define thread_local __thread
-#endif
-
 #include <iostream>
 
 struct _jit_expr_proxy;
@@ -42,30 +41,82 @@ namespace {
     std::vector<t_outlet *> outs;
     std::vector<struct _jit_expr_proxy *> proxies;
 
-    parse::Driver driver;
-    xnor::LLVMCodeGenVisitor cv;
-
-    xnor::LLVMCodeGenVisitor::function_t func;
+    //the source, parsed again when the trees are needed after creation
+    std::string expression;
+
+    //filled in by the compile thread, the kernel may be shared with other
+    //objects that have the same expression
+    std::shared_ptr<xnor::KernelSlot> kernel;
+    t_clock * poll_clock = nullptr;
+    //runs the expression until the kernel is ready
+    std::unique_ptr<xnor::Interpreter> interpreter;
+    unsigned int interpreted = 0;
+    xnor::CompileOptions options;
     XnorExpr expr_type = XnorExpr::CONTROL;
 
+    //jit/expr compiles the batch kernel when it is first needed
+    std::shared_ptr<xnor::KernelSlot> batch_kernel;
+    bool batch_error = false;
+    std::vector<float> batch_in; //frames of each float and int input, one after the other
+    std::vector<float> batch_out; //frames of each output
+
     std::vector<float> outfloat;
     std::vector<float *> outarg;
     std::vector<float> infloats;
     std::vector<t_symbol *> symbol_inputs;
     std::map<unsigned int, std::pair<t_sample*, size_t>> saved_inputs; //pair is data and size of data in bytes
     std::map<unsigned int, std::pair<t_sample*, size_t>> saved_outputs;
+    //$x buffers hold two blocks, the current one alternates between the halves so the
+    //previous block never has to be moved
+    std::vector<t_sample *> input_blocks; //the current and previous block of each input
+    bool input_phase = false; //the current block is in the second half
+    std::vector<float *> samplearg; //jit/fexpr~ outputs followed by the saved outputs
+
+    //built by dsp so perform only has to copy what changes from block to block
+    struct history_copy {
+      t_sample * in;
+      t_sample * buffer; //both blocks
+      t_sample ** blocks; //what the input arg points to
+    };
+    struct perform_plan {
+      int n = 0;
+      std::vector<unsigned int> floats; //float and int inputs
+      std::vector<unsigned int> symbols;
+      std::vector<std::pair<t_sample *, t_sample *>> copies; //vectors that alias an output, pd's buffer and the saved one
+      std::vector<history_copy> histories; //$x inputs
+      std::vector<t_sample *> outputs;
+    } plan;
 
     std::vector<xnor::LLVMCodeGenVisitor::input_arg_t> inarg;
     std::vector<ast::Variable::VarType> input_types;
     int signal_inputs = 0; //could just calc from input_types
 
     bool compute = true;
-    std::string code_printout;
+
+    //counted around every kernel call, cheap enough to always keep, cleared with reset
+    struct run_stats {
+      uint64_t calls = 0;
+      uint64_t samples = 0;
+      uint64_t cycles = 0;
+      jit_expr_helper_calls helpers = {0, 0, 0};
+
+      //a call that started at start, when the helpers had been called before times
+      void add(int nframes, uint64_t start, const jit_expr_helper_calls& before) {
+        cycles += xnor::cycles() - start;
+        calls++;
+        samples += nframes;
+        helpers.tables += jit_expr_helper_counts.tables - before.tables;
+        helpers.value_gets += jit_expr_helper_counts.value_gets - before.value_gets;
+        helpers.value_sets += jit_expr_helper_counts.value_sets - before.value_sets;
+      }
+    } stats;
 
     //constructor
     cpp_expr(XnorExpr t) : expr_type(t) { };
     ~cpp_expr() {
       free_io_buffers();
+      if (poll_clock)
+        clock_free(poll_clock);
       for (auto i: ins)
         inlet_free(i);
       ins.clear();
@@ -75,6 +126,8 @@ namespace {
       outs.clear();
     }
 
+    void run(float ** out, xnor::LLVMCodeGenVisitor::input_arg_t * in, int nframes);
+
     void free_io_buffers() {
       for (auto& it : saved_inputs) {
         auto& p = it.second;
@@ -98,40 +151,30 @@ namespace {
 
 extern "C" void *jit_expr_new(t_symbol *s, int argc, t_atom *argv);
 extern "C" void jit_expr_free(struct _jit_expr * x);
+extern "C" void jit_expr_poll(struct _jit_expr * x);
 extern "C" void jit_expr_start(struct _jit_expr * x);
 extern "C" void jit_expr_stop(struct _jit_expr * x);
 extern "C" void jit_expr_print(struct _jit_expr * x);
+extern "C" void jit_expr_stats(struct _jit_expr * x);
+extern "C" void jit_expr_reset(struct _jit_expr * x);
 extern "C" void jit_expr_version(struct _jit_expr * x);
 extern "C" void jit_expr_setup(void);
 extern "C" void jit_fexpr_tilde_set(struct _jit_expr *x, t_symbol *s, int argc, t_atom *argv);
 extern "C" void jit_fexpr_tilde_clear(struct _jit_expr *x, t_symbol *s, int argc, t_atom *argv);
 
-//functions called from generated code
-extern "C" float jit_expr_fact(float v);
-extern "C" float * jit_expr_table_value_ptr(t_symbol * name, float findex);
-extern "C" float jit_expr_table_size(t_symbol * name);
-extern "C" float jit_expr_table_sum(t_symbol * name, float start, float end);
-extern "C" float jit_expr_table_sum_all(t_symbol * name);
-extern "C" float jit_expr_max(float a, float b);
-extern "C" float jit_expr_min(float a, float b);
-extern "C" float jit_expr_random(float a, float b);
-extern "C" float jit_expr_imodf(float v);
-extern "C" float jit_expr_modf(float v);
-
-extern "C" float jit_expr_isnan(float v);
-extern "C" float jit_expr_isinf(float v);
-extern "C" float jit_expr_finite(float v);
-
-extern "C" float jit_expr_value_assign(t_symbol * name, float v);
-extern "C" float jit_expr_value_get(t_symbol * name);
-extern "C" float jit_expr_deref(float * v);
-
-extern "C" float jit_expr_array_read(float * array, float index, int array_length);
-
 static t_class *jit_expr_class;
 static t_class *jit_expr_proxy_class;
 static t_class *jit_expr_tilde_class;
 static t_class *jit_fexpr_tilde_class;
+static t_class *jit_expr_settings_class;
+
+//used by objects that don't override them, set with messages to the jit_expr receiver
+static xnor::CompileOptions jit_expr_default_options;
+
+//how often we check on a compile that is in progress
+static const double jit_expr_poll_ms = 10.0;
+//how many times an expression is interpreted before we compile it
+static const unsigned int jit_expr_tier_up_count = 32;
 
 typedef struct _jit_expr {
   t_object x_obj;
@@ -145,10 +188,33 @@ typedef struct _jit_expr_proxy {
   t_jit_expr *parent;
 } t_jit_expr_proxy;
 
+typedef struct _jit_expr_settings {
+  t_pd p_pd;
+} t_jit_expr_settings;
+
+//one parser for every object, only used from the pd thread
+static parse::Driver& jit_expr_driver() {
+  static parse::Driver driver;
+  return driver;
+}
+
+//the simplified trees of an expression that has been parsed before
+static std::vector<ast::NodePtr> jit_expr_parse(const std::string& expression, const xnor::CompileOptions& options) {
+  auto statements = xnor::simplify(jit_expr_driver().parse_string(expression), options.accuracy);
+  jit_expr_driver().reset();
+  return statements;
+}
+
+//"native" and no name both mean the host
+static std::string jit_expr_cpu_name(t_symbol * s) {
+  if (s == &s_ || strcmp(s->s_name, "native") == 0)
+    return std::string();
+  return s->s_name;
+}
+
 
 void *jit_expr_new(t_symbol *s, int argc, t_atom *argv)
 {
-  //create the driver and code visitor
   t_jit_expr *x = NULL;
 
   if (strcmp("jit/expr~", s->s_name) == 0) {
@@ -164,10 +230,31 @@ void *jit_expr_new(t_symbol *s, int argc, t_atom *argv)
     x->cpp = std::make_shared<cpp_expr>(XnorExpr::CONTROL);
   }
 
+  //creation flags come before the expression
+  x->cpp->options = jit_expr_default_options;
+  int first = 0;
+  while (first < argc && argv[first].a_type == A_SYMBOL) {
+    auto flag = argv[first].a_w.w_symbol->s_name;
+    if (strcmp(flag, "-cpu") == 0 && first + 1 < argc && argv[first + 1].a_type == A_SYMBOL) {
+      x->cpp->options.cpu = jit_expr_cpu_name(argv[first + 1].a_w.w_symbol);
+      first += 2;
+    } else if (strcmp(flag, "-fastmath") == 0) {
+      x->cpp->options.fastmath = true;
+      first += 1;
+    } else if (strcmp(flag, "-accuracy") == 0 && first + 1 < argc && argv[first + 1].a_type == A_SYMBOL) {
+      auto name = argv[first + 1].a_w.w_symbol->s_name;
+      if (!xnor::MathLibrary::parse(name, x->cpp->options.accuracy))
+        error("%s: unknown accuracy %s, use precise, fast or libm", s->s_name, name);
+      first += 2;
+    } else {
+      break;
+    }
+  }
+
   //read in the arguments into a string
   char buf[1024];
   std::string line;
-  for (int i = 0; i < argc; i++) {
+  for (int i = first; i < argc; i++) {
     atom_string(&argv[i], buf, 1024);
     line += " " + std::string(buf);
   }
@@ -180,12 +267,25 @@ void *jit_expr_new(t_symbol *s, int argc, t_atom *argv)
   try {
     //make sure there is more than just a space
     if (line.find_first_not_of(' ') == std::string::npos) {
-      x->cpp->func = nullptr;
+      x->cpp->kernel = nullptr;
     } else {
-      auto statements = x->cpp->driver.parse_string(line);
-      x->cpp->func = x->cpp->cv.function(statements, x->cpp->code_printout);
+      auto& driver = jit_expr_driver();
+      auto statements = xnor::simplify(driver.parse_string(line), x->cpp->options.accuracy);
+      auto inputs = driver.inputs();
+      //objects only keep the source, the trees are parsed again when the expression is compiled
+      driver.reset();
+      x->cpp->expression = line;
+
+      //throws for unknown cpus
+      xnor::JIT::instance().targetMachine(x->cpp->options.cpu);
+      //if nobody has compiled this expression yet we interpret it and only
+      //compile it once it has been run enough times
+      x->cpp->kernel = xnor::KernelCache::instance().slot(s->s_name, statements, x->cpp->options, s->s_name + line);
+      if (!x->cpp->kernel->done()) {
+        x->cpp->interpreter.reset(new xnor::Interpreter(statements));
+        x->cpp->poll_clock = clock_new(x, (t_method)jit_expr_poll);
+      }
 
-      auto inputs = x->cpp->driver.inputs();
       //we automatically have at least one input even if we're not using it
       if (inputs.size() == 0) {
         auto v = std::make_shared<ast::Variable>(x->cpp->expr_type == XnorExpr::CONTROL ? ast::Variable::VarType::FLOAT : ast::Variable::VarType::VECTOR, 0);
@@ -195,6 +295,7 @@ void *jit_expr_new(t_symbol *s, int argc, t_atom *argv)
       x->cpp->infloats.resize(inputs.size(), 0);
       x->cpp->symbol_inputs.resize(inputs.size(), nullptr);
       x->cpp->inarg.resize(inputs.size());
+      x->cpp->input_blocks.resize(inputs.size() * 2, nullptr);
       x->cpp->input_types.resize(inputs.size(), ast::Variable::VarType::FLOAT); //this will be overwritten when the variables are set up
 
       x->cpp->signal_inputs = 0;
@@ -248,6 +349,7 @@ void *jit_expr_new(t_symbol *s, int argc, t_atom *argv)
               x->cpp->outs.push_back(outlet_new(&x->x_obj, &s_signal));
               x->cpp->saved_outputs[i] = {nullptr, 0};
             }
+            x->cpp->samplearg.resize(statements.size() * 2, nullptr);
           }
           break;
       }
@@ -312,8 +414,42 @@ void jit_expr_free(t_jit_expr * x) {
   x->cpp = nullptr;
 }
 
+void cpp_expr::run(float ** out, xnor::LLVMCodeGenVisitor::input_arg_t * in, int nframes) {
+  auto helpers = jit_expr_helper_counts;
+  auto start = xnor::cycles();
+
+  auto func = kernel->function();
+  if (func != nullptr) {
+    func(out, in, nframes);
+  } else {
+    interpreter->run(out, in, nframes);
+    //hot, schedule the compile from the pd thread
+    if (++interpreted == jit_expr_tier_up_count)
+      clock_delay(poll_clock, 0);
+  }
+
+  stats.add(nframes, start, helpers);
+}
+
+//submit the compile and report errors from the pd thread
+void jit_expr_poll(t_jit_expr * x) {
+  auto k = x->cpp->kernel;
+  if (!k->done() && !k->submitted())
+    xnor::KernelCache::instance().submit(k, jit_expr_parse(x->cpp->expression, x->cpp->options));
+  if (!k->done()) {
+    clock_delay(x->cpp->poll_clock, jit_expr_poll_ms);
+    return;
+  }
+  if (k->function() == nullptr) {
+    //keep interpreting
+    pd_error(x, "error compiling: %s", k->error().c_str());
+    return;
+  }
+  x->cpp->interpreter = nullptr;
+}
+
 void jit_expr_bang(t_jit_expr * x) {
-  if (x->cpp->func == nullptr)
+  if (x->cpp->kernel == nullptr)
     return;
 
   //assign input values
@@ -334,13 +470,152 @@ void jit_expr_bang(t_jit_expr * x) {
   }
 
   //execute function
-  x->cpp->func(&x->cpp->outarg.front(), &x->cpp->inarg.front(), 1);
+  x->cpp->run(&x->cpp->outarg.front(), &x->cpp->inarg.front(), 1);
 
   //output!
   for (unsigned int i = 0; i < x->cpp->outarg.size(); i++)
     outlet_float(x->cpp->outs.at(i), *(x->cpp->outarg.at(i)));
 }
 
+static bool jit_expr_numeric_input(ast::Variable::VarType t) {
+  return t == ast::Variable::VarType::FLOAT || t == ast::Variable::VarType::INT;
+}
+
+//how many values make up one input tuple of a batch
+static int jit_expr_batch_width(t_jit_expr * x) {
+  return std::count_if(x->cpp->input_types.begin(), x->cpp->input_types.end(), jit_expr_numeric_input);
+}
+
+//evaluate nframes input tuples from batch_in into batch_out
+static void jit_expr_run_batch(t_jit_expr * x, int nframes) {
+  auto& cpp = x->cpp;
+  if (!cpp->batch_kernel) {
+    //a batch is a hot loop already, so it is compiled right away
+    auto options = cpp->options;
+    options.batch = true;
+    auto statements = jit_expr_parse(cpp->expression, options);
+    cpp->batch_kernel = xnor::KernelCache::instance().slot("jit/expr", statements, options,
+        "jit/expr batch" + cpp->expression);
+    xnor::KernelCache::instance().submit(cpp->batch_kernel, statements);
+  }
+
+  auto func = cpp->batch_kernel->function();
+  if (!func && cpp->batch_kernel->done() && !cpp->batch_error) {
+    pd_error(x, "error compiling batch: %s", cpp->batch_kernel->error().c_str());
+    cpp->batch_error = true;
+  }
+
+  //until the batch kernel is ready we go through the regular one, a frame at a time
+  int frames = func ? 1 : nframes;
+  for (int f = 0; f < frames; f++) {
+    int k = 0;
+    for (size_t i = 0; i < cpp->inarg.size(); i++) {
+      if (jit_expr_numeric_input(cpp->input_types.at(i))) {
+        float * in = &cpp->batch_in.at(k++ * nframes);
+        if (func)
+          cpp->inarg.at(i).vec = in;
+        else
+          cpp->inarg.at(i).flt = in[f];
+      } else {
+        cpp->inarg.at(i).sym = cpp->symbol_inputs.at(i);
+      }
+    }
+    for (size_t i = 0; i < cpp->outarg.size(); i++)
+      cpp->outarg.at(i) = &cpp->batch_out.at(i * nframes + f);
+
+    if (func) {
+      auto helpers = jit_expr_helper_counts;
+      auto start = xnor::cycles();
+      func(&cpp->outarg.front(), &cpp->inarg.front(), nframes);
+      cpp->stats.add(nframes, start, helpers);
+    } else
+      cpp->run(&cpp->outarg.front(), &cpp->inarg.front(), 1);
+  }
+
+  for (size_t i = 0; i < cpp->outarg.size(); i++)
+    cpp->outarg.at(i) = &cpp->outfloat.at(i);
+}
+
+//input tuples with a value for each float and int inlet, each outlet sends a list of its results
+static void jit_expr_batch(t_jit_expr *x, t_symbol * /*s*/, int argc, t_atom *argv) {
+  if (x->cpp->kernel == nullptr || argc == 0)
+    return;
+  int width = jit_expr_batch_width(x);
+  if (width == 0 || argc % width != 0) {
+    pd_error(x, "jit/expr batch: needs a multiple of %d values", width);
+    return;
+  }
+
+  int nframes = argc / width;
+  x->cpp->batch_in.resize(argc);
+  x->cpp->batch_out.resize(x->cpp->outarg.size() * nframes);
+  for (int f = 0; f < nframes; f++) {
+    for (int k = 0; k < width; k++)
+      x->cpp->batch_in[k * nframes + f] = atom_getfloat(argv + f * width + k);
+  }
+
+  jit_expr_run_batch(x, nframes);
+
+  std::vector<t_atom> list(nframes);
+  for (unsigned int i = 0; i < x->cpp->outarg.size(); i++) {
+    for (int f = 0; f < nframes; f++)
+      SETFLOAT(&list[f], x->cpp->batch_out[i * nframes + f]);
+    outlet_list(x->cpp->outs.at(i), &s_list, nframes, &list.front());
+  }
+}
+
+//a table for each float and int inlet then a table for each outlet,
+//as many frames as the shortest table has are evaluated
+static void jit_expr_batchtable(t_jit_expr *x, t_symbol * /*s*/, int argc, t_atom *argv) {
+  if (x->cpp->kernel == nullptr)
+    return;
+  int width = jit_expr_batch_width(x);
+  int outputs = x->cpp->outarg.size();
+  if (argc != width + outputs) {
+    pd_error(x, "jit/expr batchtable: needs %d input and %d output tables", width, outputs);
+    return;
+  }
+
+  std::vector<t_garray *> tables;
+  std::vector<t_word *> words;
+  int nframes = INT_MAX;
+  for (int i = 0; i < argc; i++) {
+    auto name = atom_getsymbolarg(i, argc, argv);
+    t_garray * a = (t_garray *)pd_findbyclass(name, garray_class);
+    int size = 0;
+    t_word * vec = nullptr;
+    if (!a) {
+      pd_error(x, "jit/expr batchtable: %s: no such table", name->s_name);
+      return;
+    }
+    if (!garray_getfloatwords(a, &size, &vec)) {
+      pd_error(x, "jit/expr batchtable: %s: bad template", name->s_name);
+      return;
+    }
+    tables.push_back(a);
+    words.push_back(vec);
+    nframes = std::min(nframes, size);
+  }
+  if (nframes == 0)
+    return;
+
+  x->cpp->batch_in.resize(width * nframes);
+  x->cpp->batch_out.resize(outputs * nframes);
+  for (int k = 0; k < width; k++) {
+    for (int f = 0; f < nframes; f++)
+      x->cpp->batch_in[k * nframes + f] = words[k][f].w_float;
+  }
+
+  jit_expr_run_batch(x, nframes);
+
+  for (int i = 0; i < outputs; i++) {
+    auto vec = words[width + i];
+    for (int f = 0; f < nframes; f++)
+      vec[f].w_float = x->cpp->batch_out[i * nframes + f];
+    garray_redraw(tables[width + i]);
+  }
+}
+
 static void jit_expr_list(t_jit_expr *x, t_symbol * /*s*/, int argc, const t_atom *argv) {
   for (int i = 0; i < std::min(argc, (int)x->cpp->infloats.size()); i++) {
     auto t = x->cpp->input_types.at(i);
@@ -359,73 +634,54 @@ void jit_expr_proxy_float(t_jit_expr_proxy *p, t_floatarg f) {
   p->parent->cpp->infloats.at(p->index) = f;
 }
 
+//update the control inputs and copy the vectors that alias an output
+static inline void jit_expr_tilde_inputs(cpp_expr * cpp, int n) {
+  const auto& plan = cpp->plan;
+  for (auto i: plan.floats)
+    cpp->inarg[i].flt = cpp->infloats[i];
+  for (auto i: plan.symbols)
+    cpp->inarg[i].sym = cpp->symbol_inputs[i];
+  for (auto& c: plan.copies)
+    memcpy(c.second, c.first, n * sizeof(t_sample));
+}
+
+//if we're not computing then we just clear everything out
+static inline bool jit_expr_tilde_stopped(cpp_expr * cpp, int n) {
+  if (cpp->compute)
+    return false;
+  for (auto p: cpp->plan.outputs)
+    memset(p, 0, n * sizeof(t_sample));
+  return true;
+}
+
 static t_int *jit_expr_tilde_perform(t_int *w) {
-  t_jit_expr *x = (t_jit_expr *)(w[1]);
-  int n = std::min((int)(w[2]), x->cpp->dsp_buffer_size);
+  cpp_expr * cpp = ((t_jit_expr *)(w[1]))->cpp.get();
+  int n = cpp->plan.n;
 
-  int vector_index = 3;
-  for (unsigned int i = 0; i < x->cpp->input_types.size(); i++) {
-    switch (x->cpp->input_types.at(i)) {
-      case ast::Variable::VarType::FLOAT:
-      case ast::Variable::VarType::INT:
-        x->cpp->inarg.at(i).flt = x->cpp->infloats.at(i);
-        break;
-      case ast::Variable::VarType::SYMBOL:
-        x->cpp->inarg.at(i).sym = x->cpp->symbol_inputs.at(i);
-        break;
-      case ast::Variable::VarType::VECTOR: {
-          //we make a copy of the input data and provide that as we might stomp on it
-          //in our function because buffers get reused
-          t_sample * in = (t_sample*)w[vector_index++];
-          t_sample * buf = x->cpp->saved_inputs.at(i).first;
-          memcpy(buf, in, n * sizeof(t_sample)); //copy the new data in
-          x->cpp->inarg.at(i).vec = buf;
-        }
-        break;
-      case ast::Variable::VarType::INPUT:
-        {
-          t_sample * in = (t_sample*)w[vector_index++];
-          t_sample * buf = x->cpp->saved_inputs.at(i).first;
-          memcpy(buf + n, buf, n * sizeof(t_sample)); //copy the old data forward
-          memcpy(buf, in, n * sizeof(t_sample)); //copy the new data in
-          x->cpp->inarg.at(i).vec = buf;
-        }
-        break;
-      default:
-        //XXX
-        break;
-    }
-  }
+  jit_expr_tilde_inputs(cpp, n);
+  if (!jit_expr_tilde_stopped(cpp, n))
+    cpp->run(cpp->outarg.data(), cpp->inarg.data(), n);
+  return w + 2;
+}
 
-  //if we're not computing then we just clear everything out
-  if (!x->cpp->compute) {
-    size_t vsize = x->cpp->dsp_buffer_size;
-    for (unsigned int i = 0; i < x->cpp->outarg.size(); i++) {
-      auto p = (t_sample *)w[vector_index++];
-      memset(p, 0, vsize * sizeof(t_sample));
-    }
-  } else {
-    if (x->cpp->expr_type == XnorExpr::SAMPLE) {
-      //render to the saved buffers [which has some old needed data into it]
-      for (unsigned int i = 0; i < x->cpp->outarg.size(); i++) {
-        x->cpp->outarg.at(i) = x->cpp->saved_outputs.at(i).first;
-      }
-      x->cpp->func(&x->cpp->outarg.front(), &x->cpp->inarg.front(), n);
+static t_int *jit_fexpr_tilde_perform(t_int *w) {
+  cpp_expr * cpp = ((t_jit_expr *)(w[1]))->cpp.get();
+  int n = cpp->plan.n;
 
-      //copy out the saved buffers
-      for (unsigned int i = 0; i < x->cpp->outarg.size(); i++) {
-        auto f = (t_sample *)w[vector_index++];
-        auto &p = x->cpp->saved_outputs.at(i);
-        memcpy(f, p.first, p.second);
-      }
-    } else {
-      for (unsigned int i = 0; i < x->cpp->outarg.size(); i++) {
-        x->cpp->outarg.at(i) = (t_sample *)w[vector_index++];
-      }
-      x->cpp->func(&x->cpp->outarg.front(), &x->cpp->inarg.front(), n);
-    }
+  jit_expr_tilde_inputs(cpp, n);
+
+  //last block's input becomes the previous block and the new data is copied over the oldest
+  bool phase = cpp->input_phase = !cpp->input_phase;
+  for (auto& h: cpp->plan.histories) {
+    h.blocks[0] = phase ? h.buffer + n : h.buffer;
+    h.blocks[1] = phase ? h.buffer : h.buffer + n;
+    memcpy(h.blocks[0], h.in, n * sizeof(t_sample));
   }
-  return w + vector_index;
+
+  //render straight to the outlets, outputs that are read are saved by the code itself
+  if (!jit_expr_tilde_stopped(cpp, n))
+    cpp->run(cpp->samplearg.data(), cpp->inarg.data(), n);
+  return w + 2;
 }
 
 //the external howto doc says:
@@ -436,75 +692,148 @@ static t_int *jit_expr_tilde_perform(t_int *w) {
 //right out-signals, finally there comes the leftmost out-signal.
 
 static void jit_expr_tilde_dsp(t_jit_expr *x, t_signal **sp) {
-  if (x->cpp->func == nullptr)
+  if (x->cpp->kernel == nullptr)
     return;
 
-  x->cpp->free_io_buffers();
+  auto& cpp = x->cpp;
+  cpp->free_io_buffers();
 
   //there is always at least one signal input
-  int input_signals = x->cpp->signal_inputs;
-  int output_signals = x->cpp->outarg.size();
-
-  int vecsize = input_signals + output_signals + 2;
-  t_int ** vec = (t_int **)getbytes(sizeof(t_int) * vecsize);
-  vec[0] = (t_int*)x;
-  vec[1] = (t_int*)sp[0]->s_n;
-  int vsize = x->cpp->dsp_buffer_size = sp[0]->s_n;
+  int input_signals = cpp->signal_inputs;
+  int output_signals = cpp->outarg.size();
 
-  //add the inputs
-  int voffset = 2;
+  int vsize = cpp->dsp_buffer_size = sp[0]->s_n;
   int invbytes = vsize * sizeof(t_sample);
-  for (int i = 0; i < input_signals; i++) {
-    vec[i + voffset] = (t_int*)sp[i]->s_vec;
-    //allocate saved buffers if we need them
-    if (i < x->cpp->input_types.size()) {
-      switch (x->cpp->input_types.at(i)) {
-        case ast::Variable::VarType::VECTOR:
-          x->cpp->saved_inputs.at(i).first = (t_sample*)getbytes(invbytes);
-          x->cpp->saved_inputs.at(i).second = invbytes;
-          break;
-        case ast::Variable::VarType::INPUT:
-          x->cpp->saved_inputs.at(i).first = (t_sample*)getbytes(invbytes * 2); //input buffers need access to last input as well
-          x->cpp->saved_inputs.at(i).second = invbytes * 2;
-          break;
-        default:
-          break;
-      }
+  cpp->input_phase = false;
+
+  auto& plan = cpp->plan;
+  plan = cpp_expr::perform_plan();
+  plan.n = vsize;
+
+  //the signals are in the order of the inputs that have them
+  int signal = 0;
+  for (unsigned int i = 0; i < cpp->input_types.size(); i++) {
+    switch (cpp->input_types[i]) {
+      case ast::Variable::VarType::FLOAT:
+      case ast::Variable::VarType::INT:
+        plan.floats.push_back(i);
+        break;
+      case ast::Variable::VarType::SYMBOL:
+        plan.symbols.push_back(i);
+        break;
+      case ast::Variable::VarType::VECTOR:
+        {
+          if (signal >= input_signals)
+            break;
+          //pd reuses input buffers for outputs. the vectorized loop checks at run time that
+          //inputs and outputs don't overlap and takes the scalar loop if they do, so a shared
+          //buffer is copied even when no statement would clobber it before it is read
+          t_sample * in = sp[signal++]->s_vec;
+          bool alias = false;
+          for (int o = 0; o < output_signals; o++)
+            alias = alias || sp[input_signals + o]->s_vec == in;
+          if (alias) {
+            auto& saved = cpp->saved_inputs.at(i);
+            saved.first = (t_sample*)getbytes(invbytes);
+            saved.second = invbytes;
+            plan.copies.push_back({in, saved.first});
+            in = saved.first;
+          }
+          cpp->inarg[i].vec = in;
+        }
+        break;
+      case ast::Variable::VarType::INPUT:
+        {
+          if (signal >= input_signals)
+            break;
+          //input buffers need access to last input as well
+          auto& saved = cpp->saved_inputs.at(i);
+          saved.first = (t_sample*)getbytes(invbytes * 2);
+          saved.second = invbytes * 2;
+          t_sample ** blocks = &cpp->input_blocks.at(i * 2);
+          plan.histories.push_back({sp[signal++]->s_vec, saved.first, blocks});
+          cpp->inarg[i].history = blocks;
+        }
+        break;
+      default:
+        break;
     }
   }
 
-  //then the outputs
-  voffset += input_signals;
-
-  //save outputs if needed
-  int outvbytes = x->cpp->expr_type == XnorExpr::SAMPLE ? (vsize * sizeof(t_sample)) : 0;
+  //then the outputs, jit/fexpr~ also passes the buffers that save them
   for (int i = 0; i < output_signals; i++) {
-    vec[i + voffset] = (t_int*)sp[i + input_signals]->s_vec;
-    if (outvbytes) {
-      x->cpp->saved_outputs.at(i).first = (t_sample*)getbytes(outvbytes);
-      x->cpp->saved_outputs.at(i).second = outvbytes;
+    t_sample * out = sp[i + input_signals]->s_vec;
+    plan.outputs.push_back(out);
+    cpp->outarg[i] = out;
+    if (cpp->expr_type == XnorExpr::SAMPLE) {
+      auto& saved = cpp->saved_outputs.at(i);
+      saved.first = (t_sample*)getbytes(invbytes);
+      saved.second = invbytes;
+      cpp->samplearg[i] = out;
+      cpp->samplearg[output_signals + i] = saved.first;
     }
   }
 
-  dsp_addv(jit_expr_tilde_perform, vecsize, (t_int*)vec);
-  freebytes(vec, sizeof(t_int) * vecsize);
+  dsp_add(cpp->expr_type == XnorExpr::SAMPLE ? jit_fexpr_tilde_perform : jit_expr_tilde_perform, 1, x);
 }
 
-void jit_expr_start(t_jit_expr *x) { x->cpp->compute = true; }
-void jit_expr_stop(t_jit_expr *x) { x->cpp->compute = false; }
-void jit_expr_print(t_jit_expr *x) {
+static const char * jit_expr_name(t_jit_expr *x) {
   switch (x->cpp->expr_type) {
     case XnorExpr::CONTROL: 
-      post("jit/expr: ");
-      break;
+      return "jit/expr";
     case XnorExpr::VECTOR: 
-      post("jit/expr~: ");
-      break;
+      return "jit/expr~";
     case XnorExpr::SAMPLE: 
-      post("jit/fexpr~: ");
-      break;
+      return "jit/fexpr~";
   }
-  std::stringstream ss(x->cpp->code_printout.c_str());
+  return "";
+}
+
+void jit_expr_stats(t_jit_expr *x) {
+  const auto& s = x->cpp->stats;
+  auto unit = xnor::cycles_unit();
+  post("%s stats:", jit_expr_name(x));
+  post("calls: %llu", (unsigned long long)s.calls);
+  post("samples: %llu", (unsigned long long)s.samples);
+  post("%s: %llu, %.2f per sample, %.2f per call", unit, (unsigned long long)s.cycles,
+      s.samples ? (double)s.cycles / s.samples : 0.0, s.calls ? (double)s.cycles / s.calls : 0.0);
+  post("table lookups: %llu", (unsigned long long)s.helpers.tables);
+  post("value gets: %llu", (unsigned long long)s.helpers.value_gets);
+  post("value sets: %llu", (unsigned long long)s.helpers.value_sets);
+  //the slot can be compiled by another object before this one's poll drops its interpreter
+  auto k = x->cpp->kernel;
+  if (k && !k->function())
+    post(k->done() ? "interpreted, compiling failed" : "interpreted, not compiled yet");
+}
+
+void jit_expr_reset(t_jit_expr *x) { x->cpp->stats = cpp_expr::run_stats(); }
+
+void jit_expr_start(t_jit_expr *x) { x->cpp->compute = true; }
+void jit_expr_stop(t_jit_expr *x) { x->cpp->compute = false; }
+void jit_expr_print(t_jit_expr *x) {
+  post("%s: ", jit_expr_name(x));
+  post("cpu: %s", x->cpp->options.cpu.size() ? x->cpp->options.cpu.c_str() : "native");
+  post("math: %s", x->cpp->options.fastmath ? "fast" : "ieee");
+  post("accuracy: %s", xnor::MathLibrary::name(x->cpp->options.accuracy).c_str());
+  auto k = x->cpp->kernel ? x->cpp->kernel->kernel() : nullptr;
+  if (!k) {
+    if (x->cpp->kernel && !x->cpp->kernel->done())
+      post("interpreted, not compiled yet");
+    return;
+  }
+
+  //objects don't keep the assembly around, it is generated again for the same code
+  std::string code;
+  try {
+    auto statements = jit_expr_parse(x->cpp->expression, x->cpp->options);
+    xnor::LLVMCodeGenVisitor::intern(statements);
+    xnor::LLVMCodeGenVisitor cv(x->cpp->options);
+    code = cv.assembly(statements);
+  } catch (std::runtime_error& e) {
+    pd_error(x, "error generating code: %s", e.what());
+    return;
+  }
+  std::stringstream ss(code);
   std::string out;
   while (std::getline(ss, out)) {
     poststring(out.c_str());
@@ -520,10 +849,46 @@ void jit_expr_version(t_jit_expr * x) {
   jit_expr_version_post();
 }
 
+static void jit_expr_settings_cpu(t_jit_expr_settings * /*x*/, t_symbol * s) {
+  auto cpu = jit_expr_cpu_name(s);
+  try {
+    xnor::JIT::instance().targetMachine(cpu);
+  } catch (std::runtime_error& e) {
+    error("jit_expr: %s", e.what());
+    return;
+  }
+  jit_expr_default_options.cpu = cpu;
+  post("jit_expr: new objects will be compiled for %s", cpu.size() ? cpu.c_str() : "the host cpu");
+}
+
+static void jit_expr_settings_fastmath(t_jit_expr_settings * /*x*/, t_floatarg f) {
+  jit_expr_default_options.fastmath = f != 0;
+  post("jit_expr: new objects will use %s math", jit_expr_default_options.fastmath ? "fast" : "ieee");
+}
+
+static void jit_expr_settings_accuracy(t_jit_expr_settings * /*x*/, t_symbol * s) {
+  if (!xnor::MathLibrary::parse(s->s_name, jit_expr_default_options.accuracy)) {
+    error("jit_expr: unknown accuracy %s, use precise, fast or libm", s->s_name);
+    return;
+  }
+  post("jit_expr: new objects will use %s math functions", s->s_name);
+}
+
 void jit_expr_setup(void) {
   xnor::LLVMCodeGenVisitor::init();
   jit_expr_version_post();
 
+  //global settings, ie [; jit_expr cpu x86-64(
+  jit_expr_settings_class = class_new(gensym("jit_expr_settings"),
+      0, 0,
+      sizeof(t_jit_expr_settings),
+      CLASS_PD,
+      A_NULL);
+  class_addmethod(jit_expr_settings_class, (t_method)jit_expr_settings_cpu, gensym("cpu"), A_DEFSYM, 0);
+  class_addmethod(jit_expr_settings_class, (t_method)jit_expr_settings_fastmath, gensym("fastmath"), A_DEFFLOAT, 0);
+  class_addmethod(jit_expr_settings_class, (t_method)jit_expr_settings_accuracy, gensym("accuracy"), A_DEFSYM, 0);
+  pd_bind(pd_new(jit_expr_settings_class), gensym("jit_expr"));
+
   jit_expr_class = class_new(gensym("jit/expr"),
       (t_newmethod)jit_expr_new,
       (t_method)jit_expr_free,
@@ -533,8 +898,12 @@ void jit_expr_setup(void) {
 
   class_addlist(jit_expr_class, jit_expr_list);
   class_addbang(jit_expr_class, jit_expr_bang);
+  class_addmethod(jit_expr_class, (t_method)jit_expr_batch, gensym("batch"), A_GIMME, 0);
+  class_addmethod(jit_expr_class, (t_method)jit_expr_batchtable, gensym("batchtable"), A_GIMME, 0);
   class_addmethod(jit_expr_class, (t_method)jit_expr_version, gensym("version"), A_NULL);
   class_addmethod(jit_expr_class, (t_method)jit_expr_print, gensym("print"), A_NULL);
+  class_addmethod(jit_expr_class, (t_method)jit_expr_stats, gensym("stats"), A_NULL);
+  class_addmethod(jit_expr_class, (t_method)jit_expr_reset, gensym("reset"), A_NULL);
   class_sethelpsymbol(jit_expr_class, gensym("jit_expr"));
 
   jit_expr_proxy_class = class_new(gensym("jit_expr_proxy"),
@@ -555,6 +924,8 @@ void jit_expr_setup(void) {
   class_addmethod(jit_expr_tilde_class, (t_method)jit_expr_version, gensym("version"), A_NULL);
   class_addmethod(jit_expr_tilde_class, (t_method)jit_expr_tilde_dsp, gensym("dsp"), A_NULL);
   class_addmethod(jit_expr_tilde_class, (t_method)jit_expr_print, gensym("print"), A_NULL);
+  class_addmethod(jit_expr_tilde_class, (t_method)jit_expr_stats, gensym("stats"), A_NULL);
+  class_addmethod(jit_expr_tilde_class, (t_method)jit_expr_reset, gensym("reset"), A_NULL);
   class_sethelpsymbol(jit_expr_tilde_class, gensym("jit_expr"));
 
   jit_fexpr_tilde_class = class_new(gensym("jit/fexpr~"),
@@ -572,138 +943,11 @@ void jit_expr_setup(void) {
   class_addmethod(jit_fexpr_tilde_class, (t_method)jit_expr_start, gensym("start"), A_NULL);
   class_addmethod(jit_fexpr_tilde_class, (t_method)jit_expr_stop, gensym("stop"), A_NULL);
   class_addmethod(jit_fexpr_tilde_class, (t_method)jit_expr_print, gensym("print"), A_NULL);
+  class_addmethod(jit_fexpr_tilde_class, (t_method)jit_expr_stats, gensym("stats"), A_NULL);
+  class_addmethod(jit_fexpr_tilde_class, (t_method)jit_expr_reset, gensym("reset"), A_NULL);
   class_sethelpsymbol(jit_fexpr_tilde_class, gensym("jit_expr"));
 }
 
-//utility functions
-
-namespace {
-  int facti(int i) {
-    if (i <= 0)
-      return 1;
-    return i * facti(i - 1);
-  }
-
-  //adapted from max_ex_tab x_vexpr_if.c
-  t_word * jit_get_table(t_symbol *name, int& sizeout) {
-    t_garray * a;
-    sizeout = 0;
-    t_word *vec;
-    if (!name || !(a = (t_garray *)pd_findbyclass(name, garray_class)) || !garray_getfloatwords(a, &sizeout, &vec)) {
-      sizeout = 0; //in case it was altered?
-      //XXX post error
-      return nullptr;
-    }
-    return vec;
-  }
-
-  //if end < 0, end == size
-  float jit_expr_table_sum_range(t_symbol * name, ssize_t start, ssize_t end) {
-    int s = 0;
-    t_word * vec = jit_get_table(name, s);
-    if (!vec)
-      return 0.0f;
-
-    ssize_t size = s;
-
-    start = std::min(std::max(start, static_cast<ssize_t>(0)), size);
-    if (end < 0)
-      end = size;
-    else
-      end = std::min(std::max(end, static_cast<ssize_t>(0)), size);
-
-    float sum = 0;
-    for (ssize_t i = start; i < end; i++)
-      sum += vec[i].w_float;
-    return sum;
-  }
-}
-
-float jit_expr_fact(float v) {
-  return static_cast<float>(facti(static_cast<int>(v)));
-}
-
-float * jit_expr_table_value_ptr(t_symbol * name, float findex) {
-  if (!name)
-    return nullptr;
-
-  int size = 0;
-  t_word * vec = jit_get_table(name, size);
-  if (!vec || size <= 0) {
-    return nullptr;
-  }
-  int index = std::min(std::max(0, static_cast<int>(findex)), size - 1);
-  return &(vec[index].w_float);
-}
-
-float jit_expr_table_size(t_symbol * name) {
-  int size = 0;
-  jit_get_table(name, size);
-  return static_cast<float>(size);
-}
-
-float jit_expr_table_sum(t_symbol * name, float fstart, float fend) {
-  if (fstart > fend || fend < 0)
-    return 0.0f;
-  return jit_expr_table_sum_range(name, static_cast<ssize_t>(fstart), static_cast<ssize_t>(fend) + 1);
-}
-
-float jit_expr_table_sum_all(t_symbol * name) {
-  return jit_expr_table_sum_range(name, 0, -1);
-}
-
-float jit_expr_max(float a, float b) { return std::max(a, b); }
-float jit_expr_min(float a, float b) { return std::min(a, b); }
-float jit_expr_random(float fstart, float fend) {
-  int start = static_cast<int>(fstart);
-  int end = static_cast<int>(fend - 1);
-  if (start >= end)
-    return 0;
-
-  //https://stackoverflow.com/questions/21237905/how-do-i-generate-thread-safe-uniform-random-numbers
-  static thread_local std::mt19937 generator;
-  std::uniform_int_distribution<int> distribution(start, end);
-  return static_cast<float>(distribution(generator));
-}
-
-float jit_expr_imodf(float v) {
-  return truncf(v);
-}
-
-float jit_expr_modf(float v) {
-  return v - truncf(v);
-}
-
-float jit_expr_isnan(float v) { return std::isnan(v) ? 1 : 0; }
-
-float jit_expr_isinf(float v) { return std::isinf(v) ? 1 : 0; }
-
-float jit_expr_finite(float v) { return std::isfinite(v) ? 1 : 0; }
-
-float jit_expr_value_assign(t_symbol * name, float v) {
-  if (name)
-    value_setfloat(name, v);
-  return v;
-}
-
-float jit_expr_value_get(t_symbol * name) {
-  float v = 0;
-  return (name && value_getfloat(name, &v) == 0) ? v : 0;
-}
-
-float jit_expr_deref(float * v) {
-  return v != 0 ? *v : 0;
-}
-
-float jit_expr_array_read(float * array, float index, int array_length) {
-  int i = static_cast<int>(index);
-  float off = index - static_cast<float>(i);
-  float v1 = array[i % array_length];
-  float v2 = array[(i + 1) % array_length];
-  return v2 * off  + v1 * (1.0 - off);
-}
-
-
 /* 
  * below based on :
  * "expr" was written by Shahrokh Yadegari c. 1989.
@@ -750,6 +994,9 @@ void jit_fexpr_tilde_set(t_jit_expr *x, t_symbol * /*s*/, int argc, t_atom *argv
           post("jit/fexpr~ set: no signal at inlet %d", vecno + 1);
           return;
         }
+        //vector inputs that are used in place and buffers before dsp have nothing to set
+        if (it->second.second == 0)
+          return;
         nargs = argc - 1;
         if (nargs <= 0) {
           post("jit/fexpr~ set: no argument to set");
@@ -760,8 +1007,10 @@ void jit_fexpr_tilde_set(t_jit_expr *x, t_symbol * /*s*/, int argc, t_atom *argv
           post("jit/fexpr~ set: only the first %d values will be set", vsize);
           nargs = vsize;
         }
+        //the next block sees the current one as the previous block
+        t_sample * current = it->second.first + (x->cpp->input_phase ? vsize : 0);
         for (int i = 0; i < nargs; i++) {
-          it->second.first[vsize - i - 1] = atom_getfloatarg(i + 1, argc, argv);
+          current[vsize - i - 1] = atom_getfloatarg(i + 1, argc, argv);
         }
       }
       return;
@@ -0,0 +1,175 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+//measures how fast compiled jit/expr~ and jit/fexpr~ kernels run, without pd
+//
+//  kernelbench [-block n]... [-channels n] [-seconds s] [-inplace] [-cpu name] [-fastmath]
+//      [-accuracy name] [-f file] [expression]...
+//
+//expressions may start with expr~ or fexpr~, otherwise the kind is picked from their variables.
+//a file has an expression per line. every -block size is run with channels objects that share the
+//kernel, the buffers are set up and copied like jit_expr_tilde_dsp and the perform routines do.
+//-inplace gives outputs the buffers of the signal inputs like pd does when it can.
+//cycles are time stamp counter ticks, which may not run at the core clock
+
+#include "kernelharness.h"
+#include "cycles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+
+namespace {
+  using timer = std::chrono::steady_clock;
+
+  //a different signal for each input and channel, within -1..1
+  std::vector<std::vector<t_sample>> sources(const harness::Channel& c, unsigned int seed) {
+    std::vector<std::vector<t_sample>> s;
+    for (size_t i = 0; i < c.input_signals; i++) {
+      std::vector<t_sample> v(c.n);
+      for (int f = 0; f < c.n; f++)
+        v[f] = std::sin(0.01f * (f + 1) * (i + 1) + seed);
+      s.push_back(v);
+    }
+    return s;
+  }
+
+  //what the objects upstream do before the perform routine runs
+  void fill(harness::Channel& c, const std::vector<std::vector<t_sample>>& sources) {
+    for (size_t i = 0; i < sources.size(); i++)
+      memcpy(c.signals[i], sources[i].data(), c.n * sizeof(t_sample));
+  }
+
+  void usage() {
+    cerr << "usage: kernelbench [-block n]... [-channels n] [-seconds s] [-inplace] [-cpu name] [-fastmath] "
+      "[-accuracy precise|fast|libm] [-f file] [expression]..." << endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char * argv[]) {
+  std::vector<int> blocks;
+  int channels = 1;
+  double duration = 0.5;
+  bool inplace = false;
+  xnor::CompileOptions options;
+  std::vector<std::string> lines;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-block" && i + 1 < argc) {
+      blocks.push_back(std::max(1, atoi(argv[++i])));
+    } else if (arg == "-channels" && i + 1 < argc) {
+      channels = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-seconds" && i + 1 < argc) {
+      duration = atof(argv[++i]);
+    } else if (arg == "-inplace") {
+      inplace = true;
+    } else if (arg == "-cpu" && i + 1 < argc) {
+      options.cpu = argv[++i];
+    } else if (arg == "-fastmath") {
+      options.fastmath = true;
+    } else if (arg == "-accuracy" && i + 1 < argc) {
+      if (!xnor::MathLibrary::parse(argv[++i], options.accuracy))
+        usage();
+    } else if (arg == "-f" && i + 1 < argc) {
+      std::ifstream in(argv[++i]);
+      if (!in) {
+        cerr << "cannot open " << argv[i] << endl;
+        return 1;
+      }
+      std::string line;
+      while (std::getline(in, line))
+        if (line.find_first_not_of(" \t") != std::string::npos)
+          lines.push_back(line);
+    } else if (arg.size() && arg[0] == '-') {
+      usage();
+    } else {
+      lines.push_back(arg);
+    }
+  }
+  if (lines.empty())
+    usage();
+  if (blocks.empty())
+    blocks.push_back(64);
+
+  xnor::LLVMCodeGenVisitor::init();
+  try {
+    xnor::JIT::instance().targetMachine(options.cpu);
+  } catch (std::runtime_error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  printf("%8s %8s %10s %12s %12s  expression\n", "block", "channels", "ns/sample", "Msamples/s", "cycles/sample");
+  int failures = 0;
+  for (auto& line: lines) {
+    harness::Kernel k;
+    harness::Expression e;
+    try {
+      e = harness::expression(line);
+      if (e.kind == harness::Kind::CONTROL)
+        throw std::runtime_error("only expr~ and fexpr~ are measured");
+      k = harness::compile(e, options);
+    } catch (std::runtime_error& err) {
+      cerr << "fail: " << line << ": " << err.what() << endl;
+      failures++;
+      continue;
+    }
+
+    for (auto n: blocks) {
+      std::vector<harness::Channel> objects;
+      std::vector<std::vector<std::vector<t_sample>>> inputs;
+      for (int c = 0; c < channels; c++) {
+        objects.emplace_back(k, n, inplace);
+        inputs.push_back(sources(objects.back(), c));
+      }
+
+      //warm up the caches and branch predictors before timing
+      for (int b = 0; b < 16; b++) {
+        for (int c = 0; c < channels; c++) {
+          fill(objects[c], inputs[c]);
+          objects[c].perform(k);
+        }
+      }
+
+      //only the perform routines are timed, not refilling the inputs
+      double elapsed = 0;
+      uint64_t ticks = 0;
+      uint64_t samples = 0;
+      while (elapsed < duration) {
+        for (int c = 0; c < channels; c++)
+          fill(objects[c], inputs[c]);
+        auto start = timer::now();
+        auto c = xnor::cycles();
+        for (auto& o: objects)
+          o.perform(k);
+        ticks += xnor::cycles() - c;
+        elapsed += std::chrono::duration<double>(timer::now() - start).count();
+        samples += static_cast<uint64_t>(n) * channels;
+      }
+
+      printf("%8d %8d %10.3f %12.2f ", n, channels, elapsed * 1e9 / samples, samples / elapsed * 1e-6);
+#ifdef XNOR_CYCLES_TSC
+      printf("%12.2f ", static_cast<double>(ticks) / samples);
+#else
+      printf("%12s ", "-");
+#endif
+      printf(" %s%s\n", harness::name(e.kind).c_str(), e.source.c_str());
+    }
+    harness::release(k);
+  }
+
+  return failures ? 2 : 0;
+}
@@ -0,0 +1,177 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "kernelharness.h"
+#include "parse/driver.hh"
+#include "interpreter/simplify.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace ast = xnor::ast;
+
+namespace {
+  //$x and $y are only read by fexpr~
+  class SampleVisitor : public ast::RecursiveVisitor {
+    public:
+      using ast::RecursiveVisitor::visit;
+      bool found = false;
+
+      virtual void visit(ast::SampleAccess* v) {
+        found = true;
+        ast::RecursiveVisitor::visit(v);
+      }
+  };
+
+  bool signal_type(ast::Variable::VarType t) {
+    return t == ast::Variable::VarType::VECTOR || t == ast::Variable::VarType::INPUT;
+  }
+}
+
+namespace harness {
+  std::string name(Kind kind) {
+    switch (kind) {
+      case Kind::CONTROL:
+        return "expr";
+      case Kind::VECTOR:
+        return "expr~";
+      case Kind::SAMPLE:
+        return "fexpr~";
+    }
+    return std::string();
+  }
+
+  Expression expression(const std::string& line) {
+    std::istringstream l(line);
+    std::string object, rest;
+    l >> object;
+    std::getline(l, rest);
+    if (object.compare(0, 4, "jit/") == 0)
+      object = object.substr(4);
+    for (auto kind: {Kind::CONTROL, Kind::VECTOR, Kind::SAMPLE}) {
+      if (object == name(kind))
+        return {kind, rest};
+    }
+
+    parse::Driver driver;
+    SampleVisitor v;
+    for (auto t: driver.parse_string(line))
+      t->accept(&v);
+    return {v.found ? Kind::SAMPLE : Kind::VECTOR, " " + line};
+  }
+
+  Kernel compile(const Expression& e, const xnor::CompileOptions& options) {
+    parse::Driver driver;
+    Kernel k;
+    k.kind = e.kind;
+    k.trees = driver.parse_string(e.source);
+    auto statements = xnor::simplify(k.trees, options.accuracy);
+    k.outputs = statements.size();
+
+    //the same checks jit_expr_new makes
+    auto inputs = driver.inputs();
+    if (inputs.empty())
+      inputs.push_back(std::make_shared<ast::Variable>(e.kind == Kind::CONTROL ? ast::Variable::VarType::FLOAT : ast::Variable::VarType::VECTOR, 0));
+    for (auto v: inputs) {
+      if (v->type() == ast::Variable::VarType::INPUT && e.kind != Kind::SAMPLE)
+        throw std::runtime_error("input sample variables only work for fexpr~");
+      if (v->type() == ast::Variable::VarType::VECTOR && e.kind == Kind::CONTROL)
+        throw std::runtime_error("vector inputs don't work for expr");
+      k.input_types.push_back(v->type());
+    }
+
+    xnor::LLVMCodeGenVisitor::intern(statements);
+    xnor::LLVMCodeGenVisitor cv(options);
+    k.function = cv.function(statements, "jit/" + name(e.kind) + e.source);
+    k.handle = cv.handle();
+    return k;
+  }
+
+  void release(Kernel& k) {
+    if (!k.function)
+      return;
+    xnor::JIT::instance().removeObject(k.handle);
+    k.function = nullptr;
+  }
+
+  Channel::Channel(const Kernel& k, int block, bool inplace) : n(block) {
+    for (auto t: k.input_types)
+      input_signals += signal_type(t) ? 1 : 0;
+
+    //reserved so pointers into the buffers stay valid
+    mBuffers.reserve(input_signals + k.outputs);
+    mSaved.reserve(k.input_types.size() + k.outputs);
+    for (size_t i = 0; i < input_signals + k.outputs; i++) {
+      if (i >= input_signals && inplace && i - input_signals < input_signals) {
+        signals.push_back(signals.at(i - input_signals));
+        continue;
+      }
+      mBuffers.push_back(std::vector<t_sample>(n, 0));
+      signals.push_back(mBuffers.back().data());
+    }
+
+    inarg.resize(k.input_types.size());
+    mInputBlocks.resize(k.input_types.size() * 2, nullptr);
+    outarg.resize(k.outputs * (k.kind == Kind::SAMPLE ? 2 : 1), nullptr);
+
+    size_t signal = 0;
+    for (size_t i = 0; i < k.input_types.size(); i++) {
+      switch (k.input_types[i]) {
+        case ast::Variable::VarType::FLOAT:
+        case ast::Variable::VarType::INT:
+          inarg[i].flt = 0.5f;
+          break;
+        case ast::Variable::VarType::SYMBOL:
+          inarg[i].sym = nullptr;
+          break;
+        case ast::Variable::VarType::VECTOR:
+          {
+            //copied if any output shares the buffer, same as jit_expr_tilde_dsp
+            t_sample * in = signals.at(signal++);
+            bool alias = false;
+            for (size_t o = 0; o < k.outputs; o++)
+              alias = alias || signals.at(input_signals + o) == in;
+            if (alias) {
+              mSaved.push_back(std::vector<t_sample>(n, 0));
+              mCopies.push_back({in, mSaved.back().data()});
+              in = mSaved.back().data();
+            }
+            inarg[i].vec = in;
+          }
+          break;
+        case ast::Variable::VarType::INPUT:
+          {
+            mSaved.push_back(std::vector<t_sample>(n * 2, 0));
+            t_sample ** blocks = &mInputBlocks.at(i * 2);
+            mHistories.push_back({signals.at(signal++), mSaved.back().data(), blocks});
+            inarg[i].history = blocks;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    for (size_t i = 0; i < k.outputs; i++) {
+      outarg[i] = signals.at(input_signals + i);
+      if (k.kind == Kind::SAMPLE) {
+        mSaved.push_back(std::vector<t_sample>(n, 0));
+        outarg[k.outputs + i] = mSaved.back().data();
+      }
+    }
+  }
+
+  void Channel::perform(const Kernel& k) {
+    for (auto& c: mCopies)
+      memcpy(c.second, c.first, n * sizeof(t_sample));
+    if (k.kind == Kind::SAMPLE) {
+      bool phase = mInputPhase = !mInputPhase;
+      for (auto& h: mHistories) {
+        h.blocks[0] = phase ? h.buffer + n : h.buffer;
+        h.blocks[1] = phase ? h.buffer : h.buffer + n;
+        memcpy(h.blocks[0], h.in, n * sizeof(t_sample));
+      }
+    }
+    k.function(outarg.data(), inarg.data(), n);
+  }
+}
@@ -0,0 +1,73 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include "ast.h"
+#include "llvmcodegen/codegen.h"
+#include <string>
+#include <vector>
+
+//compiles expressions and runs their kernels the way the objects do, for the tools that run without pd
+namespace harness {
+  enum class Kind {
+    CONTROL,
+    VECTOR,
+    SAMPLE
+  };
+
+  struct Expression {
+    Kind kind;
+    std::string source;
+  };
+
+  //the object name without jit/
+  std::string name(Kind kind);
+
+  //lines may start with the object name, with or without jit/, otherwise they are
+  //expr~ unless they read $x or $y
+  Expression expression(const std::string& line);
+
+  struct Kernel {
+    Kind kind = Kind::VECTOR;
+    std::vector<xnor::ast::NodePtr> trees; //as parsed, before they were simplified
+    size_t outputs = 0;
+    std::vector<xnor::ast::Variable::VarType> input_types;
+    xnor::LLVMCodeGenVisitor::function_t function = nullptr;
+    xnor::JIT::ObjectHandleT handle;
+  };
+
+  //throws std::runtime_error if the expression doesn't parse or compile
+  Kernel compile(const Expression& e, const xnor::CompileOptions& options);
+  void release(Kernel& k);
+
+  //one object with its buffers set up like jit_expr_tilde_dsp, jit/expr uses blocks of 1
+  struct Channel {
+    int n = 0;
+    size_t input_signals = 0;
+    std::vector<t_sample *> signals; //signal inputs then outputs, outputs may share an input's buffer
+
+    std::vector<xnor::LLVMCodeGenVisitor::input_arg_t> inarg; //float inputs start at 0.5
+    std::vector<float *> outarg; //jit/fexpr~ outputs followed by the saved outputs
+
+    //inplace gives outputs the buffers of the signal inputs like pd does when it can
+    Channel(const Kernel& k, int block, bool inplace);
+    Channel(Channel&&) = default;
+
+    //jit_expr_tilde_perform and jit_fexpr_tilde_perform
+    void perform(const Kernel& k);
+
+    private:
+      std::vector<std::vector<t_sample>> mBuffers; //stand in for pd's signal vectors
+      std::vector<std::vector<t_sample>> mSaved;
+      std::vector<t_sample *> mInputBlocks;
+      bool mInputPhase = false;
+
+      std::vector<std::pair<t_sample *, t_sample *>> mCopies;
+      struct history_copy {
+        t_sample * in;
+        t_sample * buffer;
+        t_sample ** blocks;
+      };
+      std::vector<history_copy> mHistories;
+  };
+}
@@ -6,7 +6,9 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <set>
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -16,6 +18,7 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/CallingConv.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/Verifier.h>
@@ -28,29 +31,187 @@
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 namespace ast = xnor::ast;
 
 namespace {
   const std::string main_function_name = "jitexpr";
+
+  using timer = std::chrono::steady_clock;
+  double seconds(timer::time_point start) {
+    return std::chrono::duration<double>(timer::now() - start).count();
+  }
+  //pd allocates signal vectors and our saved buffers with getbytes, which only has malloc's
+  //alignment, 8 bytes on 32 bit targets. max_align_t can claim more than malloc gives there
+  const uint64_t signal_alignment = 2 * sizeof(void *);
+  //table floats are stored in t_words
+  const int table_stride = sizeof(t_word) / sizeof(t_float);
   const std::map<std::string, std::string> function_alias = {
     {"Sum", "jit_expr_table_sum"},
     {"sum", "jit_expr_table_sum_all"},
     {"size", "jit_expr_table_size"},
     {"fact", "jit_expr_fact"},
-    {"max", "jit_expr_max"},
-    {"min", "jit_expr_min"},
-    {"random", "jit_expr_random"},
-    {"imodf", "jit_expr_imodf"},
-    {"modf", "jit_expr_modf"},
     {"random", "jit_expr_random"},
-    {"isnan", "jit_expr_isnan"},
-    {"isinf", "jit_expr_isinf"},
-    {"finite", "jit_expr_finite"},
-    {"ln", "logf"},
-    {"abs", "fabsf"},
+  };
+
+  //exact replacements for libm functions, the optimizer and vectorizer know all about them
+  const std::map<std::string, llvm::Intrinsic::ID> intrinsic_functions = {
+    {"abs", llvm::Intrinsic::fabs},
+    {"ceil", llvm::Intrinsic::ceil},
+    {"copysign", llvm::Intrinsic::copysign},
+    {"floor", llvm::Intrinsic::floor},
+    {"imodf", llvm::Intrinsic::trunc},
+    {"nearbyint", llvm::Intrinsic::nearbyint},
+    {"rint", llvm::Intrinsic::rint},
+    {"round", llvm::Intrinsic::round},
+    {"trunc", llvm::Intrinsic::trunc},
+  };
+
+  //integer constant indexes like the implicit $y1[-1] or an explicit $x1[-2]
+  bool constant_index(const ast::NodePtr& n, int& index) {
+    if (auto v = std::dynamic_pointer_cast<ast::Value<int>>(n)) {
+      index = v->value();
+      return true;
+    }
+    if (auto v = std::dynamic_pointer_cast<ast::Value<float>>(n)) {
+      float f = v->value();
+      if (f != std::floor(f) || std::fabs(f) > 1e6f)
+        return false;
+      index = static_cast<int>(f);
+      return true;
+    }
+    auto u = std::dynamic_pointer_cast<ast::UnaryOp>(n);
+    if (u && u->op() == ast::UnaryOp::Op::NEGATE && constant_index(u->node(), index)) {
+      index = -index;
+      return true;
+    }
+    return false;
+  }
+
+  //the deepest $x or $y offset that is kept in registers, deeper ones are read from the buffers
+  const int max_register_history = 16;
+
+  //finds how far back each $x and $y input is read at constant offsets
+  class HistoryVisitor : public ast::RecursiveVisitor {
+    public:
+      using ast::RecursiveVisitor::visit;
+      typedef std::pair<ast::Variable::VarType, unsigned int> key_t;
+
+      const std::map<key_t, std::pair<ast::VariablePtr, int>>& depths() const { return mDepths; }
+      //the outputs that are read at all, their values have to be saved for the next block
+      const std::set<unsigned int>& outputs() const { return mOutputs; }
+
+      virtual void visit(ast::SampleAccess* v) {
+        ast::RecursiveVisitor::visit(v);
+        auto source = v->source();
+        if (source->type() == ast::Variable::VarType::OUTPUT)
+          mOutputs.insert(source->input_index());
+        int index = 0;
+        if (!constant_index(v->index_node(), index))
+          return;
+        //outputs can't be read at the current frame, same as the clamp in codegen
+        index = std::min(index, source->type() == ast::Variable::VarType::OUTPUT ? -1 : 0);
+        if (index >= 0 || -index > max_register_history)
+          return;
+        auto& d = mDepths[{source->type(), source->input_index()}];
+        d.first = source;
+        d.second = std::max(d.second, -index);
+      }
+    private:
+      std::map<key_t, std::pair<ast::VariablePtr, int>> mDepths;
+      std::set<unsigned int> mOutputs;
+  };
+
+  //functions that have to see nans and infs, even in fast math mode
+  const std::set<std::string> ieee_functions = {
+    "isnan", "isinf", "finite"
+  };
+
+  //finds the pure subtrees that only depend on constants and control rate inputs,
+  //they are computed once per block instead of once per sample
+  class InvariantVisitor : public ast::RecursiveVisitor {
+    public:
+      using ast::RecursiveVisitor::visit;
+
+      InvariantVisitor(bool batch) : mBatch(batch) { }
+
+      const std::set<ast::Node *>& invariant() const { return mInvariant; }
+
+      //everything but signal vectors, input and output variables are the buffer pointers.
+      //batches have a vector for each float and int input too
+      virtual void visit(ast::Variable* v) {
+        switch (v->type()) {
+          case ast::Variable::VarType::VECTOR:
+            return;
+          case ast::Variable::VarType::FLOAT:
+          case ast::Variable::VarType::INT:
+            if (mBatch)
+              return;
+            break;
+          default:
+            break;
+        }
+        mark(v);
+      }
+      virtual void visit(ast::Value<int>* v) { mark(v); }
+      virtual void visit(ast::Value<float>* v) { mark(v); }
+      virtual void visit(ast::Quoted* v) {
+        ast::RecursiveVisitor::visit(v);
+        if (!v->variable() || is(v->variable().get()))
+          mark(v);
+      }
+      virtual void visit(ast::UnaryOp* v) {
+        ast::RecursiveVisitor::visit(v);
+        if (is(v->node().get()))
+          mark(v);
+      }
+      virtual void visit(ast::BinaryOp* v) {
+        ast::RecursiveVisitor::visit(v);
+        if (is(v->left().get()) && is(v->right().get()))
+          mark(v);
+      }
+      virtual void visit(ast::FunctionCall* v) {
+        ast::RecursiveVisitor::visit(v);
+        if (ast::impure_functions.count(v->name()))
+          return;
+        for (auto a: v->args()) {
+          if (!is(a.get()))
+            return;
+        }
+        mark(v);
+      }
+    private:
+      bool mBatch;
+      std::set<ast::Node *> mInvariant;
+      void mark(ast::Node * n) { mInvariant.insert(n); }
+      bool is(ast::Node * n) const { return mInvariant.count(n) != 0; }
+  };
+
+  //collects every name that codegen turns into a symbol
+  class SymbolInternVisitor : public ast::RecursiveVisitor {
+    public:
+      using ast::RecursiveVisitor::visit;
+
+      virtual void visit(ast::Value<std::string>* v) { xnor::JIT::instance().intern(v->value()); }
+      virtual void visit(ast::Quoted* v) {
+        if (v->value().size())
+          xnor::JIT::instance().intern(v->value());
+        ast::RecursiveVisitor::visit(v);
+      }
+      virtual void visit(ast::ArrayAccess* v) {
+        if (v->name().size())
+          xnor::JIT::instance().intern(v->name());
+        ast::RecursiveVisitor::visit(v);
+      }
+      virtual void visit(ast::ValueAssignment* v) {
+        xnor::JIT::instance().intern(v->value_name());
+        ast::RecursiveVisitor::visit(v);
+      }
   };
 }
 
@@ -62,37 +223,38 @@ namespace xnor {
     llvm::InitializeNativeTargetAsmParser();
   }
 
-  LLVMCodeGenVisitor::LLVMCodeGenVisitor() :
+  void LLVMCodeGenVisitor::intern(const std::vector<ast::NodePtr>& statements) {
+    SymbolInternVisitor v;
+    for (auto s: statements)
+      s->accept(&v);
+  }
+
+  std::string CompileOptions::key() const {
+    return "cpu=" + cpu + " fastmath=" + (fastmath ? "1" : "0") + " accuracy=" + MathLibrary::name(accuracy)
+      + " batch=" + (batch ? "1" : "0");
+  }
+
+  LLVMCodeGenVisitor::LLVMCodeGenVisitor(const CompileOptions& options) :
     mContext(),
     mBuilder(mContext),
-    mTargetMachine(llvm::EngineBuilder().selectTarget()),
-    mDataLayout(mTargetMachine->createDataLayout()),
-    mObjectLayer([]() { return std::make_shared<llvm::SectionMemoryManager>(); }),
-    mCompileLayer(mObjectLayer, llvm::orc::SimpleCompiler(*mTargetMachine))
+    mOptions(options),
+    mDataLayout(JIT::instance().dataLayout())
   {
-    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr); //XXX do we want this?
-
     mModule = llvm::make_unique<llvm::Module>("jit/expr", mContext);
     mModule->setDataLayout(mDataLayout);
+    mMathLibrary = llvm::make_unique<MathLibrary>(mModule.get(), mOptions.accuracy);
+
+    //applies to every float operation and call the builder creates
+    if (mOptions.fastmath) {
+      llvm::FastMathFlags fmf;
+      fmf.setUnsafeAlgebra();
+      mBuilder.setFastMathFlags(fmf);
+    }
 
     mSymbolPtrType = llvm::PointerType::get(llvm::StructType::create(mContext, "t_symbol_ptr"), 0); //opaque
     mFloatType = llvm::Type::getFloatTy(mContext);
     mIntType = llvm::Type::getInt32Ty(mContext);
 
-    mFunctionPassManager = llvm::make_unique<llvm::legacy::FunctionPassManager>(mModule.get());
-#if 1
-    // Do simple "peephole" optimizations and bit-twiddling optzns.
-    mFunctionPassManager->add(llvm::createInstructionCombiningPass());
-    // Reassociate expressions.
-    mFunctionPassManager->add(llvm::createReassociatePass());
-    // Eliminate Common SubExpressions.
-    mFunctionPassManager->add(llvm::createGVNPass());
-    // Simplify the control flow graph (deleting unreachable blocks, etc).
-    mFunctionPassManager->add(llvm::createCFGSimplificationPass());
-#endif
-
-    mFunctionPassManager->doInitialization();
-
     std::vector<llvm::Type*> argTypes;
     argTypes.push_back(llvm::PointerType::get(llvm::PointerType::get(mFloatType, 0), 0));
 
@@ -106,6 +268,12 @@ namespace xnor {
 
     llvm::FunctionType *ftype = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), llvm::makeArrayRef(argTypes), false);
     mMainFunction = llvm::Function::Create(ftype, llvm::GlobalValue::InternalLinkage, main_function_name, mModule.get());
+    //the output and input arrays are never written through the signal pointers they hold,
+    //so their loads can be hoisted out of the loop
+    mMainFunction->addParamAttr(0, llvm::Attribute::NoAlias);
+    mMainFunction->addParamAttr(1, llvm::Attribute::NoAlias);
+    //we look it up by name so the module passes can't drop it
+    llvm::appendToUsed(*mModule, {mMainFunction});
     mBlock = llvm::BasicBlock::Create(mContext, "entry", mMainFunction, 0);
     mBuilder.SetInsertPoint(mBlock);
 
@@ -131,52 +299,46 @@ namespace xnor {
   }
 
   void LLVMCodeGenVisitor::visit(ast::Variable* v){
+    if (hoist(v))
+      return;
     //XXX is there a better index?
     auto index = llvm::ConstantInt::get(mIntType, v->input_index());
 
     llvm::Value * cur = nullptr;
 
-    if (v->type() != ast::Variable::VarType::OUTPUT) {
+    if (v->type() != ast::Variable::VarType::OUTPUT && v->type() != ast::Variable::VarType::INPUT) {
       cur = mBuilder.CreateLoad(mInput);
       cur = mBuilder.CreateInBoundsGEP(mInputType, cur, index);
     }
 
     switch(v->type()) {
       case ast::Variable::VarType::FLOAT:
+        if (mOptions.batch) {
+          mValue = loadFrame(cur, "inputf" + std::to_string(v->input_index()), false);
+          break;
+        }
         cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(mFloatType, 0));
         mValue = mBuilder.CreateLoad(cur, "inputf" + std::to_string(v->input_index()));
         break;
       case ast::Variable::VarType::INT:
         {
-          cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(mFloatType, 0));
-          cur = mBuilder.CreateLoad(cur);
-          mValue = createFunctionCall("floorf", 
-              llvm::FunctionType::get(mFloatType, {mFloatType}, false),
-              { cur }, "inputi" + std::to_string(v->input_index()));
+          if (mOptions.batch) {
+            cur = loadFrame(cur, std::string(), false);
+          } else {
+            cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(mFloatType, 0));
+            cur = mBuilder.CreateLoad(cur);
+          }
+          mValue = intrinsic(llvm::Intrinsic::floor, { cur });
+          mValue->setName("inputi" + std::to_string(v->input_index()));
         }
         break;
       case ast::Variable::VarType::VECTOR:
-        {
-          cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(llvm::PointerType::get(mFloatType, 0), 0));
-          cur = mBuilder.CreateLoad(cur);
-          cur = mBuilder.CreateInBoundsGEP(mFloatType, cur, mFrameIndex);
-          mValue = mBuilder.CreateLoad(cur, "inputv" + std::to_string(v->input_index()));
-        }
+        mValue = loadFrame(cur, "inputv" + std::to_string(v->input_index()), true);
         break;
       case ast::Variable::VarType::INPUT:
-        {
-          //returns a float pointer
-          cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(llvm::PointerType::get(mFloatType, 0), 0));
-          mValue = mBuilder.CreateLoad(cur, "inputx" + std::to_string(v->input_index()));
-        }
-        break;
       case ast::Variable::VarType::OUTPUT:
-        {
-          //returns a float pointer
-          cur = mBuilder.CreateLoad(mOutput);
-          cur = mBuilder.CreateInBoundsGEP(llvm::PointerType::get(mFloatType, 0), cur, llvm::ConstantInt::get(mIntType, v->input_index()));
-          mValue = mBuilder.CreateLoad(cur, "inputy" + std::to_string(v->input_index()));
-        }
+        //returns a pointer to the current block
+        mValue = historyBlocks(v->type(), v->input_index()).first;
         break;
       case ast::Variable::VarType::SYMBOL:
         {
@@ -217,6 +379,8 @@ namespace xnor {
   }
 
   void LLVMCodeGenVisitor::visit(ast::UnaryOp* v){
+    if (hoist(v))
+      return;
     v->node()->accept(this);
     auto right = mValue;
 
@@ -240,6 +404,8 @@ namespace xnor {
   }
 
   void LLVMCodeGenVisitor::visit(ast::BinaryOp* v){
+    if (hoist(v))
+      return;
     v->left()->accept(this);
     auto left = mValue;
 
@@ -325,6 +491,8 @@ namespace xnor {
   }
 
   void LLVMCodeGenVisitor::visit(ast::FunctionCall* v){
+    if (hoist(v))
+      return;
     auto n = v->name();
 
     //if
@@ -353,9 +521,28 @@ namespace xnor {
       return;
     }
 
+    //generate the whole argument with strict semantics so nans and infs survive until the test
+    llvm::IRBuilder<>::FastMathFlagGuard guard(mBuilder);
+    if (ieee_functions.count(n))
+      mBuilder.clearFastMathFlags();
+
+    //visit the children, store them in the args
+    std::vector<llvm::Value *> args;
+    for (auto a: v->args()) {
+      a->accept(this);
+      args.push_back(mValue);
+    }
+
+    if (auto value = builtin(n, args)) {
+      mValue = value;
+      wrapIntIfNeeded(v);
+      return;
+    }
+
     //table functions
     auto it = function_alias.find(n);
-    if (it != function_alias.end()) {
+    bool libm = it == function_alias.end();
+    if (!libm) {
       n = it->second;
     } else {
       n = n + "f"; //we're using the floating point version of these calls
@@ -363,44 +550,69 @@ namespace xnor {
 
     llvm::Function * f = mModule->getFunction(n);
     if (!f) {
-      std::vector<llvm::Type *> args;
+      std::vector<llvm::Type *> types;
       for (auto a: v->args())
-        args.push_back(a->output_type() == ast::Node::OutputType::STRING ? mSymbolPtrType : mFloatType);
+        types.push_back(a->output_type() == ast::Node::OutputType::STRING ? mSymbolPtrType : mFloatType);
 
-      llvm::FunctionType *ft = llvm::FunctionType::get(mFloatType, args, false);
+      llvm::FunctionType *ft = llvm::FunctionType::get(mFloatType, types, false);
       f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, n, mModule.get());
       if (!f)
         throw std::runtime_error("cannot find function with name: " + v->name());
+      //nothing reads errno, so libm calls can be hoisted and combined like any other math
+      if (libm) {
+        f->addFnAttr(llvm::Attribute::ReadNone);
+        f->addFnAttr(llvm::Attribute::NoUnwind);
+      }
 
       //XXX is it a leak if we don't store this somewhere??
     }
 
-    //visit the children, store them in the args
-    std::vector<llvm::Value *> args;
-    for (auto a: v->args()) {
-      a->accept(this);
-      args.push_back(mValue);
-    }
-
     mValue = mBuilder.CreateCall(f, args, "calltmp");
     wrapIntIfNeeded(v);
   }
 
   void LLVMCodeGenVisitor::visit(ast::SampleAccess* v) {
+    int constant = 0;
+    int clamp_top = (v->source()->type() == ast::Variable::VarType::OUTPUT) ? -1 : 0;
+    if (constant_index(v->index_node(), constant)) {
+      //previous frames that are kept in registers
+      int depth = -std::min(constant, clamp_top);
+      auto it = mHistory.find({v->source()->type(), v->source()->input_index()});
+      if (depth > 0 && it != mHistory.end() && depth <= static_cast<int>(it->second.values.size())) {
+        mValue = it->second.values.at(depth - 1);
+        wrapIntIfNeeded(v);
+        return;
+      }
+    }
+
+    auto blocks = historyBlocks(v->source()->type(), v->source()->input_index());
+
+    if (constant_index(v->index_node(), constant)) {
+      //a whole sample, no interpolation needed
+      if (std::min(constant, clamp_top) < 0) {
+        //clamp to -frame_size and offset with the current sample and the previous block
+        llvm::Value * index = llvm::ConstantInt::get(mIntType, std::min(constant, clamp_top));
+        auto bottom = mBuilder.CreateNeg(mFrameCount, "bottom");
+        auto lt = mBuilder.CreateICmpSLT(index, bottom, "lttmp");
+        index = mBuilder.CreateAdd(mBuilder.CreateSelect(lt, bottom, index), mFrameIndex, "offset");
+        mValue = historyLoad(blocks, mBuilder.CreateAdd(index, mFrameCount));
+      } else {
+        auto p = mBuilder.CreateInBoundsGEP(mFloatType, blocks.first, mFrameIndex);
+        mValue = mBuilder.CreateLoad(p, "tmpsample");
+      }
+      wrapIntIfNeeded(v);
+      return;
+    }
+
     //get the index node
     v->index_node()->accept(this);
     auto index = mValue;
 
-    //get the variable
-    v->source()->accept(this);
-    auto var = mValue; //this is a pointer to a float
-
-    float clamp_top = (v->source()->type() == ast::Variable::VarType::OUTPUT) ? -1.0f : 0;
-    auto top = llvm::ConstantFP::get(mFloatType, clamp_top);
+    auto top = llvm::ConstantFP::get(mFloatType, static_cast<float>(clamp_top));
     auto zero = llvm::ConstantFP::get(mFloatType, 0.0f);
     auto bottom = mBuilder.CreateFSub(zero, toFloat(mFrameCount), "bottom");
 
-    //clamp index between -frame_size and clamp_top
+    //clamp index between -frame_size and clamp_top, nan ends up at the top
     //index < top ? index : top
     auto lt = mBuilder.CreateFCmpOLT(index, top, "lttmp");
     index = mBuilder.CreateSelect(lt, index, top);
@@ -409,52 +621,48 @@ namespace xnor {
     lt = mBuilder.CreateFCmpOLT(index, bottom, "lttmp");
     index = mBuilder.CreateSelect(lt, bottom, index);
 
-    //offset with the current sample index
-    index = mBuilder.CreateFAdd(index, toFloat(mFrameIndex), "offset");
-
-
-    llvm::Value * arrayLength;
-    //input buffers are actually 2x as long because you have to be able to previous values as well
-    if (v->source()->type() == ast::Variable::VarType::INPUT)
-      arrayLength = toFloat(mBuilder.CreateShl(mFrameCount, llvm::ConstantInt::get(mIntType, 1)));
-    else
-      arrayLength = toFloat(mFrameCount);
-
-    //index < 0 : frame_count + index : index
-    lt = mBuilder.CreateFCmpOLT(index, zero, "ltmp");
-
-    //actually just add zero or the array length
-    auto offset = mBuilder.CreateSelect(lt, arrayLength, zero);
-    index = mBuilder.CreateFAdd(index, offset);
-
-#if 0
-    index = toInt(index);
-    auto p = mBuilder.CreateInBoundsGEP(mFloatType, var, index);
-    mValue = mBuilder.CreateLoad(p);
-#else
-    mValue = createFunctionCall("jit_expr_array_read", 
-        llvm::FunctionType::get(mFloatType, {llvm::PointerType::get(mFloatType, 0), mFloatType, mIntType}, false),
-        { var, index, toInt(arrayLength) }, "tmparrayinterp");
-#endif
+    //offset with the current sample index and the previous block
+    index = mBuilder.CreateFAdd(index, toFloat(mBuilder.CreateAdd(mFrameIndex, mFrameCount)), "offset");
+
+    //now 0 <= index <= frame_count + current frame, the second sample is only past that
+    //when the fraction is zero, so it is clamped to stay inside the current block
+    auto i0 = toInt(index);
+    auto frac = mBuilder.CreateFSub(index, toFloat(i0), "frac");
+    auto i1 = mBuilder.CreateAdd(i0, llvm::ConstantInt::get(mIntType, 1));
+    auto last = mBuilder.CreateSub(mBuilder.CreateShl(mFrameCount, llvm::ConstantInt::get(mIntType, 1)), llvm::ConstantInt::get(mIntType, 1));
+    i1 = mBuilder.CreateSelect(mBuilder.CreateICmpSGT(i1, last), last, i1);
+
+    auto v0 = historyLoad(blocks, i0);
+    auto v1 = historyLoad(blocks, i1);
+
+    //v1 * frac + v0 * (1 - frac)
+    auto one = llvm::ConstantFP::get(mFloatType, 1.0f);
+    mValue = mBuilder.CreateFAdd(
+        mBuilder.CreateFMul(v1, frac),
+        mBuilder.CreateFMul(v0, mBuilder.CreateFSub(one, frac)), "tmparrayinterp");
     wrapIntIfNeeded(v);
   }
 
   void LLVMCodeGenVisitor::visit(ast::ArrayAccess* v){
-    if (v->name().size()) {
-      auto sym = getSymbol(v->name());
-      mValue = mBuilder.CreateBitCast(sym, mSymbolPtrType);
-    } else {
-      v->name_var()->accept(this);
-    }
-
-    auto name = mValue;
+    auto table = resolveTable(v);
+    auto data = table.first;
+    auto size = table.second;
 
     v->index_node()->accept(this);
     auto index = mValue;
 
-    mValue = createFunctionCall("jit_expr_table_value_ptr", 
-        llvm::FunctionType::get(llvm::PointerType::get(mFloatType, 0), {mSymbolPtrType, mFloatType}, false),
-        { name, index }, "tmparrayaccess");
+    //clamp between 0 and size - 1, nan goes to 0
+    auto zero = llvm::ConstantFP::get(mFloatType, 0.0f);
+    auto top = toFloat(mBuilder.CreateSub(size, llvm::ConstantInt::get(mIntType, 1)));
+    index = mBuilder.CreateSelect(mBuilder.CreateFCmpOGT(index, zero), index, zero);
+    index = mBuilder.CreateSelect(mBuilder.CreateFCmpOLT(index, top), index, top);
+    auto i = toInt(index);
+    //an empty table clamps to -1
+    i = mBuilder.CreateSelect(mBuilder.CreateICmpSLT(i, llvm::ConstantInt::get(mIntType, 0)), llvm::ConstantInt::get(mIntType, 0), i);
+    i = mBuilder.CreateMul(i, llvm::ConstantInt::get(mIntType, table_stride));
+
+    mValue = mBuilder.CreateInBoundsGEP(mFloatType, data, i, "tmparrayaccess");
+    mTableSize = size;
   }
 
   void LLVMCodeGenVisitor::visit(ast::ValueAssignment* v){
@@ -481,15 +689,55 @@ namespace xnor {
   void LLVMCodeGenVisitor::visit(ast::Deref* v) {
     v->value_node()->accept(this); //returns a pointer to a float
 
-    //XXX gen code for this, its real simple
-    mValue = createFunctionCall("jit_expr_deref",
-        llvm::FunctionType::get(mFloatType, {llvm::PointerType::get(mFloatType, 0)}, false),
-        {mValue}, "tmpderef");
+    //missing tables read as 0
+    auto value = mBuilder.CreateLoad(mValue, "tmpderef");
+    auto found = mBuilder.CreateICmpSGT(mTableSize, llvm::ConstantInt::get(mIntType, 0));
+    mValue = mBuilder.CreateSelect(found, value, llvm::ConstantFP::get(mFloatType, 0.0f));
     wrapIntIfNeeded(v);
   }
 
-  LLVMCodeGenVisitor::function_t LLVMCodeGenVisitor::function(std::vector<ast::NodePtr> statements, std::string& print_out) {
+  LLVMCodeGenVisitor::function_t LLVMCodeGenVisitor::function(std::vector<ast::NodePtr> statements, const std::string& name) {
+    auto obj = object(statements);
+    auto start = timer::now();
+    mHandle = JIT::instance().addObject(std::move(obj), name);
+    auto func = lookup(mHandle);
+    mTimings.load = seconds(start);
+    return func;
+  }
+
+  LLVMCodeGenVisitor::function_t LLVMCodeGenVisitor::lookup(JIT::ObjectHandleT handle) {
+    auto addr = JIT::instance().address(handle, main_function_name);
+    if (!addr) {
+      JIT::instance().removeObject(handle);
+      throw std::runtime_error("couldn't find symbol " + main_function_name);
+    }
+    return reinterpret_cast<function_t>((uintptr_t)addr);
+  }
+
+  const std::string& LLVMCodeGenVisitor::mainFunctionName() {
+    return main_function_name;
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> LLVMCodeGenVisitor::object(std::vector<ast::NodePtr> statements) {
+    generate(statements);
+    auto start = timer::now();
+    auto obj = JIT::instance().compile(*mModule, mOptions.cpu);
+    mTimings.emit = seconds(start);
+    return obj;
+  }
+
+  std::string LLVMCodeGenVisitor::assembly(std::vector<ast::NodePtr> statements) {
+    generate(statements);
+    std::string s;
+    llvm::raw_string_ostream ss(s);
+    mModule->print(ss, nullptr);
+    return ss.str();
+  }
+
+  void LLVMCodeGenVisitor::generate(std::vector<ast::NodePtr> statements) {
+    auto start = timer::now();
     llvm::Value * cur = nullptr;
+    mOutputCount = statements.size();
 
     auto outargt = llvm::PointerType::get(llvm::PointerType::get(mFloatType, 0), 0);
     llvm::Value * output = mBuilder.CreateAlloca(outargt, (unsigned)0);
@@ -504,43 +752,128 @@ namespace xnor {
     //loop start
     llvm::Value * StartVal = llvm::ConstantInt::get(mIntType, 0);
     llvm::Function *TheFunction = mBuilder.GetInsertBlock()->getParent();
-    llvm::BasicBlock *PreheaderBB = mBuilder.GetInsertBlock();
+
+    //block invariant code is emitted here while the loop body is generated,
+    //the preheader is only terminated once all the statements are done
+    mPreheader = llvm::BasicBlock::Create(mContext, "invariant", TheFunction);
+    mBuilder.CreateBr(mPreheader);
+    mBuilder.SetInsertPoint(mPreheader);
+
+    std::vector<llvm::Value *> outputs;
+    for (unsigned int i = 0; i < statements.size(); i++) {
+      auto index = llvm::ConstantInt::get(mIntType, i);
+      cur = mBuilder.CreateLoad(mOutput);
+      cur = mBuilder.CreateInBoundsGEP(llvm::PointerType::get(mFloatType, 0), cur, index);
+      outputs.push_back(mBuilder.CreateLoad(cur, "output" + std::to_string(i)));
+    }
+
+    InvariantVisitor invariant(mOptions.batch);
+    for (auto s: statements)
+      s->accept(&invariant);
+    mInvariant = invariant.invariant();
+
     llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(mContext, "loop", TheFunction);
+    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(mContext, "afterloop");
 
-    // Insert an explicit fall through from the current block to the LoopBB.
-    mBuilder.CreateBr(LoopBB);
     // Start insertion in LoopBB.
     mBuilder.SetInsertPoint(LoopBB);
 
-    // Start the PHI node with an entry for Start.
+    // Start the PHI node, the entry for Start is added once the preheader is done.
     llvm::PHINode *Variable = mBuilder.CreatePHI(mIntType, 2, "loopvar");
-    Variable->addIncoming(StartVal, PreheaderBB);
 
     mFrameIndex = Variable;
-    //add statements
+
+    //$x and $y read at constant offsets are passed from frame to frame in registers
+    //so recurrences don't go through memory, the buffers are only read to start the block
+    HistoryVisitor history;
+    for (auto s: statements)
+      s->accept(&history);
+    for (auto& it: history.depths()) {
+      auto var = it.second.first;
+      History h;
+      h.input = var->type() == ast::Variable::VarType::INPUT;
+      if (!h.input && var->input_index() >= outputs.size())
+        continue;
+      for (int j = 0; j < it.second.second; j++)
+        h.values.push_back(mBuilder.CreatePHI(mFloatType, 2, "history"));
+      mHistory[it.first] = h;
+    }
+    for (auto& it: mHistory) {
+      auto& h = it.second;
+      h.buffer = historyBlocks(it.first.first, it.first.second).second;
+      if (h.input) {
+        auto current = historyBlocks(it.first.first, it.first.second).first;
+        h.current = mBuilder.CreateLoad(mBuilder.CreateInBoundsGEP(mFloatType, current, mFrameIndex), "current");
+      }
+    }
+
+    //add statements, outputs that are read are saved in their history as well
+    std::vector<llvm::Value *> results;
     for (unsigned int i = 0; i < statements.size(); i++) {
-      auto index = llvm::ConstantInt::get(mIntType, i);
-      cur = mBuilder.CreateLoad(mOutput);
-      cur = mBuilder.CreateInBoundsGEP(llvm::PointerType::get(mFloatType, 0), cur, index);
-      cur = mBuilder.CreateLoad(cur);
-      cur = mBuilder.CreateInBoundsGEP(mFloatType, cur, mFrameIndex);
+      cur = mBuilder.CreateInBoundsGEP(mFloatType, outputs.at(i), mFrameIndex);
 
       statements.at(i)->accept(this);
       mBuilder.CreateStore(mValue, cur);
+      if (history.outputs().count(i)) {
+        auto saved = historyBlocks(ast::Variable::VarType::OUTPUT, i).first;
+        mBuilder.CreateStore(mValue, mBuilder.CreateInBoundsGEP(mFloatType, saved, mFrameIndex));
+      }
+      results.push_back(mValue);
     }
 
     // Emit the step value.
-    llvm::Value *NextVar = mBuilder.CreateAdd(Variable, llvm::ConstantInt::get(mIntType, 1), "nextvar");
+    llvm::Value *NextVar = mBuilder.CreateNSWAdd(Variable, llvm::ConstantInt::get(mIntType, 1), "nextvar");
     llvm::Value *EndVal = mFrameCount;
-    llvm::Value *EndCond = mBuilder.CreateICmpNE(EndVal, NextVar);
+    llvm::Value *EndCond = mBuilder.CreateICmpSLT(NextVar, EndVal);
 
-    // Create the "after loop" block and insert it.
+    // Insert the "after loop" block.
     llvm::BasicBlock *LoopEndBB = mBuilder.GetInsertBlock();
-    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(mContext, "afterloop", TheFunction);
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+
+    //shift the history by a frame. offsets past the block size are clamped to -n like the
+    //buffer path, so with fewer frames than registers the deeper ones follow register n - 1
+    for (auto& it: mHistory) {
+      auto& h = it.second;
+      llvm::Value * value = h.input ? h.current : results.at(it.first.second);
+      for (size_t j = 0; j < h.values.size(); j++) {
+        if (j > 0) {
+          auto clamped = mBuilder.CreateICmpSLE(mFrameCount, llvm::ConstantInt::get(mIntType, j), "clamped");
+          value = mBuilder.CreateSelect(clamped, value, h.values.at(j - 1));
+        }
+        h.values.at(j)->addIncoming(value, LoopEndBB);
+      }
+    }
 
     // Insert the conditional branch into the end of LoopEndBB.
     mBuilder.CreateCondBr(EndCond, LoopBB, AfterBB);
 
+    // Skip empty blocks so the loop has a trip count the vectorizer can use.
+    mBuilder.SetInsertPoint(mPreheader);
+    auto LoopEntryBB = mPreheader;
+    if (mHistory.empty()) {
+      mBuilder.CreateCondBr(mBuilder.CreateICmpSGT(mFrameCount, StartVal), LoopBB, AfterBB);
+    } else {
+      //the history starts with the end of the previous block, with the same clamp as the other
+      //constant offsets, only read when there are frames so the buffers exist
+      LoopEntryBB = llvm::BasicBlock::Create(mContext, "history", TheFunction, LoopBB);
+      mBuilder.CreateCondBr(mBuilder.CreateICmpSGT(mFrameCount, StartVal), LoopEntryBB, AfterBB);
+      mBuilder.SetInsertPoint(LoopEntryBB);
+      auto bottom = mBuilder.CreateNeg(mFrameCount, "bottom");
+      for (auto& it: mHistory) {
+        auto& h = it.second;
+        for (size_t j = 0; j < h.values.size(); j++) {
+          auto offset = llvm::ConstantInt::get(mIntType, -static_cast<int>(j + 1));
+          auto lt = mBuilder.CreateICmpSLT(offset, bottom, "lttmp");
+          auto index = mBuilder.CreateAdd(mFrameCount, mBuilder.CreateSelect(lt, bottom, offset));
+          auto value = mBuilder.CreateLoad(mBuilder.CreateInBoundsGEP(mFloatType, h.buffer, index), "start");
+          h.values.at(j)->addIncoming(value, LoopEntryBB);
+        }
+      }
+      mBuilder.CreateBr(LoopBB);
+    }
+    Variable->addIncoming(StartVal, LoopEntryBB);
+    mPreheader = nullptr;
+
     // Any new code will be inserted in AfterBB.
     mBuilder.SetInsertPoint(AfterBB);
 
@@ -549,72 +882,137 @@ namespace xnor {
 
     mBuilder.CreateRet(nullptr);
     llvm::verifyFunction(*mMainFunction);
-    mFunctionPassManager->run(*mMainFunction);
+    mTimings.generate = seconds(start);
 
-    {
-      std::string s;
-      llvm::raw_string_ostream ss(s);
-      mModule->print(ss, nullptr);
-      print_out = ss.str();
-    }
-
-    auto Resolver = llvm::orc::createLambdaResolver(
-        [&](const std::string &Name) {
-          if (auto Sym = findMangledSymbol(Name))
-            return Sym;
-          return llvm::JITSymbol(nullptr);
-        },
-        [](const std::string &/*S*/) { return nullptr; });
-    auto H = llvm::cantFail(mCompileLayer.addModule(std::move(mModule), std::move(Resolver)));
-    mModuleHandles.push_back(H);
-
-    auto ExprSymbol = findSymbol(main_function_name);
-    if (!ExprSymbol)
-      throw std::runtime_error("couldn't find symbol " + main_function_name);
-
-    function_t func = reinterpret_cast<function_t>((uintptr_t)cantFail(ExprSymbol.getAddress()));
-    return func;
+    start = timer::now();
+    optimize();
+    mTimings.optimize = seconds(start);
   }
 
-  llvm::JITSymbol LLVMCodeGenVisitor::findSymbol(const std::string Name) {
-    return findMangledSymbol(mangle(Name));
+  bool LLVMCodeGenVisitor::hoist(ast::Node * n) {
+    if (mHoisting || !mPreheader || mInvariant.count(n) == 0)
+      return false;
+    inPreheader([this, n]() { n->accept(this); });
+    return true;
   }
 
-  llvm::JITSymbol LLVMCodeGenVisitor::findMangledSymbol(const std::string &Name) {
-    const bool ExportedSymbolsOnly = false;
+  void LLVMCodeGenVisitor::inPreheader(std::function<void()> gen) {
+    if (mHoisting || !mPreheader) {
+      gen();
+      return;
+    }
 
-    // Search modules in reverse order: from last added to first added.
-    // This is the opposite of the usual search order for dlsym, but makes more
-    // sense in a REPL where we want to bind to the newest available definition.
+    //generate at the end of the preheader, which may add blocks, then continue where we were
+    auto block = mBuilder.GetInsertBlock();
+    mBuilder.SetInsertPoint(mPreheader);
+    mHoisting = true;
+    gen();
+    mHoisting = false;
+    mPreheader = mBuilder.GetInsertBlock();
+    mBuilder.SetInsertPoint(block);
+  }
 
-    for (auto H : llvm::make_range(mModuleHandles.rbegin(), mModuleHandles.rend()))
-      if (auto Sym = mCompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
-        return Sym;
+  llvm::Value * LLVMCodeGenVisitor::loadFrame(llvm::Value * cur, const std::string& name, bool aligned) {
+    cur = mBuilder.CreateBitCast(cur, llvm::PointerType::get(llvm::PointerType::get(mFloatType, 0), 0));
+    auto vec = mBuilder.CreateLoad(cur);
+    if (aligned) {
+      vec->setMetadata(llvm::LLVMContext::MD_align, llvm::MDNode::get(mContext,
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt64Ty(mContext), signal_alignment))));
+    }
+    vec->setMetadata(llvm::LLVMContext::MD_nonnull, llvm::MDNode::get(mContext, {}));
+    cur = mBuilder.CreateInBoundsGEP(mFloatType, vec, mFrameIndex);
+    return mBuilder.CreateLoad(cur, name);
+  }
 
-    // If we can't find the symbol in the JIT, try looking in the host process.
-    if (auto SymAddr = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(Name))
-      return llvm::JITSymbol(SymAddr, llvm::JITSymbolFlags::Exported);
+  std::pair<llvm::Value *, llvm::Value *> LLVMCodeGenVisitor::historyBlocks(ast::Variable::VarType type, unsigned int index) {
+    auto it = mHistoryBlocks.find({type, index});
+    if (it != mHistoryBlocks.end())
+      return it->second;
+
+    std::pair<llvm::Value *, llvm::Value *> blocks;
+    inPreheader([this, type, index, &blocks]() {
+      auto floatptr = llvm::PointerType::get(mFloatType, 0);
+      if (type == ast::Variable::VarType::INPUT) {
+        //the input arg points to the current and previous block
+        auto cur = mBuilder.CreateInBoundsGEP(mInputType, mBuilder.CreateLoad(mInput), llvm::ConstantInt::get(mIntType, index));
+        cur = mBuilder.CreateLoad(mBuilder.CreateBitCast(cur, llvm::PointerType::get(llvm::PointerType::get(floatptr, 0), 0)));
+        blocks.first = mBuilder.CreateLoad(cur, "inputx" + std::to_string(index));
+        cur = mBuilder.CreateInBoundsGEP(floatptr, cur, llvm::ConstantInt::get(mIntType, 1));
+        blocks.second = mBuilder.CreateLoad(cur, "previousx" + std::to_string(index));
+      } else {
+        //the saved output still holds the previous block past the current frame
+        auto cur = mBuilder.CreateInBoundsGEP(floatptr, mBuilder.CreateLoad(mOutput), llvm::ConstantInt::get(mIntType, mOutputCount + index));
+        blocks.first = blocks.second = mBuilder.CreateLoad(cur, "inputy" + std::to_string(index));
+      }
+    });
+    mHistoryBlocks[{type, index}] = blocks;
+    return blocks;
+  }
 
-#ifdef LLVM_ON_WIN32
-    // For Windows retry without "_" at beginning, as RTDyldMemoryManager uses
-    // GetProcAddress and standard libraries like msvcrt.dll use names
-    // with and without "_" (for example "_itoa" but "sin").
-    if (Name.length() > 2 && Name[0] == '_')
-      if (auto SymAddr =
-              llvm::RTDyldMemoryManager::getSymbolAddressInProcess(Name.substr(1)))
-        return llvm::JITSymbol(SymAddr, llvm::JITSymbolFlags::Exported);
-#endif
+  llvm::Value * LLVMCodeGenVisitor::historyLoad(const std::pair<llvm::Value *, llvm::Value *>& blocks, llvm::Value * index) {
+    auto previous = mBuilder.CreateICmpSLT(index, mFrameCount, "previous");
+    auto block = mBuilder.CreateSelect(previous, blocks.second, blocks.first);
+    index = mBuilder.CreateSelect(previous, index, mBuilder.CreateSub(index, mFrameCount));
+    return mBuilder.CreateLoad(mBuilder.CreateInBoundsGEP(mFloatType, block, index), "tmpsample");
+  }
 
-    return nullptr;
+  std::pair<llvm::Value *, llvm::Value *> LLVMCodeGenVisitor::resolveTable(ast::ArrayAccess * v) {
+    //names are either constant or come from a symbol inlet, so tables only have to be found once per block
+    std::string key = v->name().size() ? v->name() : "$s" + std::to_string(v->name_var()->input_index());
+    auto it = mTables.find(key);
+    if (it != mTables.end())
+      return it->second;
+
+    std::pair<llvm::Value *, llvm::Value *> table;
+    inPreheader([this, v, &table]() {
+      llvm::Value * name = nullptr;
+      if (v->name().size()) {
+        name = getSymbol(v->name());
+      } else {
+        v->name_var()->accept(this);
+        name = mValue;
+      }
+      //allocas belong in the entry block so they are promoted to registers
+      auto& entry = mMainFunction->getEntryBlock();
+      llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+      auto size = entryBuilder.CreateAlloca(mIntType);
+      auto data = createFunctionCall("jit_expr_table_resolve",
+          llvm::FunctionType::get(llvm::PointerType::get(mFloatType, 0), {mSymbolPtrType, llvm::PointerType::get(mIntType, 0)}, false),
+          { name, size }, "table");
+      table = { data, mBuilder.CreateLoad(size, "tablesize") };
+    });
+    mTables[key] = table;
+    return table;
   }
 
-  std::string LLVMCodeGenVisitor::mangle(const std::string &Name) {
-    std::string MangledName;
-    {
-      llvm::raw_string_ostream MangledNameStream(MangledName);
-      llvm::Mangler::getNameWithPrefix(MangledNameStream, Name, mDataLayout);
-    }
-    return MangledName;
+  void LLVMCodeGenVisitor::optimize() {
+    auto& tm = JIT::instance().targetMachine(mOptions.cpu);
+
+    //the usual -O3 pipeline, with mem2reg, licm, loop rotation and both vectorizers.
+    //the loop vectorizer adds runtime overlap checks for the signal vectors and a
+    //scalar epilogue for block sizes that aren't a multiple of the vector width
+    llvm::PassManagerBuilder builder;
+    builder.OptLevel = 3;
+    builder.SizeLevel = 0;
+    builder.LoopVectorize = true;
+    builder.SLPVectorize = true;
+    builder.LibraryInfo = new llvm::TargetLibraryInfoImpl(tm.getTargetTriple());
+    //the math library functions are always inlined so their loops can be vectorized
+    builder.Inliner = llvm::createFunctionInliningPass(builder.OptLevel, builder.SizeLevel, false);
+    tm.adjustPassManager(builder);
+
+    llvm::legacy::FunctionPassManager fpm(mModule.get());
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+    builder.populateFunctionPassManager(fpm);
+
+    llvm::legacy::PassManager mpm;
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+    builder.populateModulePassManager(mpm);
+
+    fpm.doInitialization();
+    fpm.run(*mMainFunction);
+    fpm.doFinalization();
+    mpm.run(*mModule);
   }
 
   llvm::Value * LLVMCodeGenVisitor::wrapLogic(llvm::Value * v) {
@@ -630,10 +1028,47 @@ namespace xnor {
   }
 
   llvm::Value * LLVMCodeGenVisitor::getSymbol(const std::string& name) {
-    t_symbol * sym = gensym(name.c_str()); //XXX hold onto symbol and free later?
-    if (!sym)
-      throw std::runtime_error("couldn't get symbol " + name);
-    return llvm::ConstantInt::get(mDataLayout.getIntPtrType(mContext, 0), reinterpret_cast<uintptr_t>(sym));
+    //the address of the symbol is filled in when the object is loaded
+    auto global = mModule->getOrInsertGlobal(JIT::symbolGlobalName(name), mBuilder.getInt8Ty());
+    return llvm::ConstantExpr::getBitCast(global, mSymbolPtrType);
+  }
+
+  llvm::Value * LLVMCodeGenVisitor::builtin(const std::string& name, const std::vector<llvm::Value *>& args) {
+    auto zero = llvm::ConstantFP::get(mFloatType, 0.0f);
+    auto inf = llvm::ConstantFP::getInfinity(mFloatType);
+
+    //same as std::max and std::min, which return the first argument for nans
+    if (name == "max")
+      return mBuilder.CreateSelect(mBuilder.CreateFCmpOLT(args.at(0), args.at(1)), args.at(1), args.at(0), "maxtmp");
+    if (name == "min")
+      return mBuilder.CreateSelect(mBuilder.CreateFCmpOLT(args.at(1), args.at(0)), args.at(1), args.at(0), "mintmp");
+    if (name == "modf")
+      return mBuilder.CreateFSub(args.at(0), intrinsic(llvm::Intrinsic::trunc, {args.at(0)}), "modftmp");
+    if (name == "fmod")
+      return mBuilder.CreateFRem(args.at(0), args.at(1), "fmodtmp");
+    if (name == "sqrt") {
+      //llvm.sqrt is undefined for negative numbers, libm gives nan
+      auto neg = mBuilder.CreateFCmpOLT(args.at(0), zero);
+      return mBuilder.CreateSelect(neg, llvm::ConstantFP::getNaN(mFloatType), intrinsic(llvm::Intrinsic::sqrt, args), "sqrttmp");
+    }
+    if (name == "isnan")
+      return wrapLogic(mBuilder.CreateFCmpUNO(args.at(0), args.at(0), "isnantmp"));
+    if (name == "isinf")
+      return wrapLogic(mBuilder.CreateFCmpOEQ(intrinsic(llvm::Intrinsic::fabs, args), inf, "isinftmp"));
+    if (name == "finite")
+      return wrapLogic(mBuilder.CreateFCmpOLT(intrinsic(llvm::Intrinsic::fabs, args), inf, "finitetmp"));
+
+    auto it = intrinsic_functions.find(name);
+    if (it != intrinsic_functions.end())
+      return intrinsic(it->second, args);
+    if (auto f = mMathLibrary->function(name))
+      return mBuilder.CreateCall(f, args, "calltmp");
+    return nullptr;
+  }
+
+  llvm::Value * LLVMCodeGenVisitor::intrinsic(llvm::Intrinsic::ID id, std::vector<llvm::Value *> args) {
+    auto f = llvm::Intrinsic::getDeclaration(mModule.get(), id, {mFloatType});
+    return mBuilder.CreateCall(f, args);
   }
 
   //condition is just a float, if it != 0.0 then the true getter value is returned, otherwise the false getter value is
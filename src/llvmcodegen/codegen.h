@@ -4,55 +4,62 @@
 #pragma once 
 
 #include "ast.h"
+#include "jit.h"
+#include "mathlib.h"
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
 
 #include <m_pd.h>
 
-#include <llvm/ADT/iterator_range.h>
-#include <llvm/ADT/STLExtras.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
-#include <llvm/ExecutionEngine/JITSymbol.h>
-#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
-#include <llvm/ExecutionEngine/SectionMemoryManager.h>
-#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
-#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
-#include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
-#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/IR/DataLayout.h>
-#include <llvm/IR/Mangler.h>
-#include <llvm/Support/DynamicLibrary.h>
-#include <llvm/Support/raw_ostream.h>
-#include <llvm/Target/TargetMachine.h>
 
 namespace llvm {
   class Module;
   class Function; 
   class Value;
   class BasicBlock;
-  class TargetMachine;
 }
 
 
 namespace xnor {
+  //how kernels are generated, objects with different options don't share code
+  struct CompileOptions {
+    std::string cpu; //see JIT::targetMachine, empty for the host
+    //allow reassociation, contraction, reciprocals and assume there are no nans or infs,
+    //except in the arguments of isnan, isinf and finite
+    bool fastmath = false;
+    //how sin, cos, exp, log, pow and tanh are computed
+    MathLibrary::Accuracy accuracy = MathLibrary::Accuracy::PRECISE;
+    //float and int inputs are vectors with a value per frame, so jit/expr can run many inputs at once
+    bool batch = false;
+
+    //identifies the options in cache keys
+    std::string key() const;
+  };
+
   class LLVMCodeGenVisitor : public xnor::ast::Visitor {
     public:
       static void init();
+      //intern the symbols the statements reference, must be called from the pd thread
+      //before the statements are compiled
+      static void intern(const std::vector<xnor::ast::NodePtr>& statements);
 
       typedef union {
         t_float flt;
         t_symbol * sym;
         t_sample * vec;
+        t_sample ** history; //$x inputs, the current block then the previous one
       } input_arg_t;
 
+      //the outputs of jit/fexpr~ are followed by a buffer for each of them that holds the
+      //previous block, the current block overwrites it as it is computed
       typedef void(*function_t)(float **, input_arg_t *, int nframes);
 
-      using ObjLayerT = llvm::orc::RTDyldObjectLinkingLayer;
-      using CompileLayerT = llvm::orc::IRCompileLayer<ObjLayerT, llvm::orc::SimpleCompiler>;
-      using ModuleHandleT = CompileLayerT::ModuleHandleT;
-
-      LLVMCodeGenVisitor();
+      LLVMCodeGenVisitor(const CompileOptions& options = CompileOptions());
       virtual ~LLVMCodeGenVisitor();
       virtual void visit(xnor::ast::Variable* v);
       virtual void visit(xnor::ast::Value<int>* v);
@@ -68,14 +75,36 @@ namespace xnor {
       virtual void visit(xnor::ast::ArrayAssignment* v);
       virtual void visit(xnor::ast::Deref* v);
 
-      function_t function(std::vector<xnor::ast::NodePtr> statements, std::string& print_out);
+      //generate and compile the statements with the shared JIT,
+      //a visitor can only be used to create a single function.
+      //name is what profilers show the function as
+      function_t function(std::vector<xnor::ast::NodePtr> statements, const std::string& name = std::string());
+      //generate the statements and compile them to object code without loading it
+      std::unique_ptr<llvm::MemoryBuffer> object(std::vector<xnor::ast::NodePtr> statements);
+      //generate the statements and return the optimized llvm assembly, nothing is compiled
+      std::string assembly(std::vector<xnor::ast::NodePtr> statements);
+      //the handle of the compiled code, valid after function() returns
+      JIT::ObjectHandleT handle() const { return mHandle; }
+
+      //seconds spent in each step, filled in as the statements are generated and compiled
+      struct Timings {
+        double generate = 0; //building the llvm ir
+        double optimize = 0;
+        double emit = 0; //compiling to object code
+        double load = 0; //linking the object into the jit, only for function()
+      };
+      const Timings& timings() const { return mTimings; }
+
+      //find the main function in loaded object code, the object is removed and
+      //std::runtime_error thrown if it isn't there
+      static function_t lookup(JIT::ObjectHandleT handle);
+      //the symbol of the main function in the object code
+      static const std::string& mainFunctionName();
     private:
       llvm::LLVMContext mContext;
       llvm::IRBuilder<> mBuilder;
 
-      std::unique_ptr<llvm::TargetMachine> mTargetMachine;
       std::unique_ptr<llvm::Module> mModule;
-      std::unique_ptr<llvm::legacy::FunctionPassManager> mFunctionPassManager;
 
       llvm::Function * mMainFunction;
       llvm::Value * mValue;
@@ -85,24 +114,60 @@ namespace xnor {
       llvm::Value * mFrameCount;
       llvm::BasicBlock * mBlock;
 
+      //where block invariant code goes, only set while the loop body is generated
+      llvm::BasicBlock * mPreheader = nullptr;
+      std::set<xnor::ast::Node *> mInvariant;
+      bool mHoisting = false;
+
+      //the previous values of $x and $y inputs read at constant offsets, carried from one frame to the next
+      struct History {
+        llvm::Value * buffer = nullptr; //the previous block
+        bool input = false;
+        llvm::Value * current = nullptr; //this frame's input sample
+        std::vector<llvm::PHINode *> values; //values[j] is j + 1 frames back
+      };
+      std::map<std::pair<xnor::ast::Variable::VarType, unsigned int>, History> mHistory;
+      //the current and previous block of $x and $y inputs, loaded in the preheader
+      std::map<std::pair<xnor::ast::Variable::VarType, unsigned int>, std::pair<llvm::Value *, llvm::Value *>> mHistoryBlocks;
+      unsigned int mOutputCount = 0;
+
+      //data pointer and size of the tables found in the preheader, by name or symbol input
+      std::map<std::string, std::pair<llvm::Value *, llvm::Value *>> mTables;
+      //the size of the table the last ArrayAccess pointed into
+      llvm::Value * mTableSize = nullptr;
+
       llvm::Type * mFloatType;
       llvm::Type * mIntType;
       llvm::Type * mInputType;
       llvm::Type * mSymbolPtrType;
 
+      const CompileOptions mOptions;
       const llvm::DataLayout mDataLayout;
-      ObjLayerT mObjectLayer;
-      CompileLayerT mCompileLayer;
-
-      std::vector<ModuleHandleT> mModuleHandles;
+      std::unique_ptr<MathLibrary> mMathLibrary;
+      JIT::ObjectHandleT mHandle;
+      Timings mTimings;
+
+      //generate the node in the preheader if it is block invariant, returns true if it did
+      bool hoist(xnor::ast::Node * n);
+      //generate in the preheader if there is one, otherwise in place
+      void inPreheader(std::function<void()> gen);
+      std::pair<llvm::Value *, llvm::Value *> resolveTable(xnor::ast::ArrayAccess * v);
+      std::pair<llvm::Value *, llvm::Value *> historyBlocks(xnor::ast::Variable::VarType type, unsigned int index);
+      //load a frame of the history, indexes below the frame count are in the previous block
+      llvm::Value * historyLoad(const std::pair<llvm::Value *, llvm::Value *>& blocks, llvm::Value * index);
+      //load the current frame from the vector input at cur, aligned if it is a signal vector
+      llvm::Value * loadFrame(llvm::Value * cur, const std::string& name, bool aligned);
+      //build and optimize the module for the statements
+      void generate(std::vector<xnor::ast::NodePtr> statements);
+      void optimize();
 
-      llvm::JITSymbol findMangledSymbol(const std::string& name);
-      llvm::JITSymbol findSymbol(const std::string name);
-      std::string mangle(const std::string& name);
       llvm::Value * wrapLogic(llvm::Value * v);
       llvm::Value * toInt(llvm::Value * v);
       llvm::Value * toFloat(llvm::Value * v);
       llvm::Value * getSymbol(const std::string& name);
+      //the expr functions that are generated inline, nullptr if the name isn't one of them
+      llvm::Value * builtin(const std::string& name, const std::vector<llvm::Value *>& args);
+      llvm::Value * intrinsic(llvm::Intrinsic::ID id, std::vector<llvm::Value *> args);
       llvm::Value * createIfFunc(std::function<llvm::Value *()> condGetter, std::function<llvm::Value *()> trueGetter, std::function<llvm::Value *()> falseGetter);
       void wrapIntIfNeeded(xnor::ast::Node * n);
 
@@ -0,0 +1,232 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+//based on the KaleidoscopeJIT example from the llvm tutorial https://llvm.org/docs/tutorial/
+
+#include "jit.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+  const std::string symbol_global_prefix = "jit_expr_sym.";
+
+  //stays the same while the object is loaded
+  const void * handle_key(xnor::JIT::ObjectHandleT handle) {
+    return &*handle;
+  }
+
+  //an empty cpu name means the host cpu with all of its features
+  llvm::TargetMachine * create_target_machine(const std::string& cpu) {
+    llvm::EngineBuilder builder;
+    if (cpu.empty()) {
+      llvm::StringMap<bool> features;
+      std::vector<std::string> attrs;
+      if (llvm::sys::getHostCPUFeatures(features)) {
+        for (auto& f: features)
+          attrs.push_back((f.second ? "+" : "-") + f.first().str());
+        std::sort(attrs.begin(), attrs.end());
+      }
+      builder.setMCPU(llvm::sys::getHostCPUName());
+      builder.setMAttrs(attrs);
+    } else {
+      builder.setMCPU(cpu);
+    }
+    return builder.selectTarget();
+  }
+}
+
+namespace xnor {
+
+  JIT& JIT::instance() {
+    //never destroyed, kernels may still be released by the compile thread at exit
+    static JIT * jit = new JIT();
+    return *jit;
+  }
+
+  JIT::JIT() :
+    mTargetMachine(create_target_machine(std::string())),
+    mDataLayout(mTargetMachine->createDataLayout()),
+    mObjectLayer([]() { return std::make_shared<llvm::SectionMemoryManager>(); },
+        //both are called while the object is finalized, which happens with mMutex held
+        [this](ObjectHandleT handle, const ObjLayerT::ObjectPtr& object, const llvm::RuntimeDyld::LoadedObjectInfo& info) {
+          auto& profiler = Profiler::instance();
+          if (!profiler.enabled())
+            return;
+          auto it = mNames.find(object.get());
+          profiler.loaded(handle_key(handle), it != mNames.end() ? it->second : std::string(), object, info);
+          if (it != mNames.end())
+            mNames.erase(it);
+        },
+        [](ObjectHandleT handle) {
+          auto& profiler = Profiler::instance();
+          if (profiler.enabled())
+            profiler.finalized(handle_key(handle));
+        })
+  {
+    llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr); //XXX do we want this?
+    mSymbolPrefix = mangle(symbol_global_prefix);
+
+    //generated code only references pd symbols and functions in the host process
+    mResolver = llvm::orc::createLambdaResolver(
+        [this](const std::string &Name) {
+          if (auto Sym = findMangledSymbol(Name))
+            return Sym;
+          return llvm::JITSymbol(nullptr);
+        },
+        [](const std::string &/*S*/) { return nullptr; });
+  }
+
+  llvm::TargetMachine& JIT::targetMachine(const std::string& cpu) {
+    if (cpu.empty() || cpu == "native")
+      return *mTargetMachine;
+
+    std::lock_guard<std::mutex> lock(mMachineMutex);
+    auto it = mTargetMachines.find(cpu);
+    if (it != mTargetMachines.end())
+      return *it->second;
+
+    std::unique_ptr<llvm::TargetMachine> tm(create_target_machine(cpu));
+    if (!tm || !tm->getMCSubtargetInfo()->isCPUStringValid(cpu))
+      throw std::runtime_error("unknown cpu " + cpu);
+    auto& r = *tm;
+    mTargetMachines[cpu] = std::move(tm);
+    return r;
+  }
+
+  std::string JIT::fingerprint(const std::string& cpu) {
+    //the cpu and feature string are all the object code depends on, pinned cpus
+    //don't depend on the host so their cached code can be moved between machines
+    auto& tm = targetMachine(cpu);
+    return "llvm " LLVM_VERSION_STRING " "
+      + tm.getTargetTriple().str() + " "
+      + tm.getTargetCPU().str() + " "
+      + tm.getTargetFeatureString().str();
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> JIT::compile(llvm::Module& module, const std::string& cpu) {
+    auto& tm = targetMachine(cpu);
+    //the target machines aren't thread safe
+    std::lock_guard<std::mutex> lock(mCompileMutex);
+    llvm::orc::SimpleCompiler compiler(tm);
+    auto object = compiler(module);
+    auto binary = object.takeBinary();
+    if (!binary.second)
+      throw std::runtime_error("couldn't compile module");
+    return std::move(binary.second);
+  }
+
+  JIT::ObjectHandleT JIT::addObject(std::unique_ptr<llvm::MemoryBuffer> object, const std::string& name) {
+    auto file = llvm::object::ObjectFile::createObjectFile(object->getMemBufferRef());
+    if (!file) {
+      llvm::consumeError(file.takeError());
+      throw std::runtime_error("invalid object code");
+    }
+    auto binary = std::make_shared<llvm::object::OwningBinary<llvm::object::ObjectFile>>(std::move(*file), std::move(object));
+    const void * key = binary.get();
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (Profiler::instance().enabled())
+      mNames[key] = name;
+    //objects can come from the disk cache, a bad one must not take pd down with it
+    auto handle = mObjectLayer.addObject(std::move(binary), mResolver);
+    if (!handle) {
+      mNames.erase(key);
+      throw std::runtime_error("couldn't add object: " + llvm::toString(handle.takeError()));
+    }
+    return *handle;
+  }
+
+  void JIT::removeObject(ObjectHandleT handle) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (Profiler::instance().enabled())
+      Profiler::instance().freed(handle_key(handle));
+    if (auto err = mObjectLayer.removeObject(handle))
+      llvm::consumeError(std::move(err));
+  }
+
+  llvm::JITTargetAddress JIT::address(ObjectHandleT handle, const std::string& name) {
+    const bool ExportedSymbolsOnly = false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto sym = mObjectLayer.findSymbolIn(handle, mangle(name), ExportedSymbolsOnly);
+    if (!sym)
+      return 0;
+    //getAddress finalizes the object so it has to happen with the lock held,
+    //unresolved symbols in a cached object show up here
+    auto addr = sym.getAddress();
+    if (!addr) {
+      llvm::consumeError(addr.takeError());
+      return 0;
+    }
+    return *addr;
+  }
+
+  t_symbol * JIT::intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mSymbolMutex);
+    auto it = mSymbols.find(name);
+    if (it != mSymbols.end())
+      return it->second;
+    t_symbol * sym = gensym(name.c_str());
+    if (!sym)
+      throw std::runtime_error("couldn't get symbol " + name);
+    mSymbols[name] = sym;
+    return sym;
+  }
+
+  t_symbol * JIT::symbol(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mSymbolMutex);
+    auto it = mSymbols.find(name);
+    if (it == mSymbols.end())
+      throw std::runtime_error("symbol " + name + " was not interned");
+    return it->second;
+  }
+
+  std::string JIT::symbolGlobalName(const std::string& name) {
+    return symbol_global_prefix + name;
+  }
+
+  llvm::JITSymbol JIT::findMangledSymbol(const std::string &Name) {
+    //pd symbols
+    if (Name.compare(0, mSymbolPrefix.size(), mSymbolPrefix) == 0) {
+      std::lock_guard<std::mutex> lock(mSymbolMutex);
+      auto it = mSymbols.find(Name.substr(mSymbolPrefix.size()));
+      if (it != mSymbols.end())
+        return llvm::JITSymbol(reinterpret_cast<uintptr_t>(it->second), llvm::JITSymbolFlags::Exported);
+      return nullptr;
+    }
+
+    // Look in the host process.
+    if (auto SymAddr = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(Name))
+      return llvm::JITSymbol(SymAddr, llvm::JITSymbolFlags::Exported);
+
+#ifdef LLVM_ON_WIN32
+    // For Windows retry without "_" at beginning, as RTDyldMemoryManager uses
+    // GetProcAddress and standard libraries like msvcrt.dll use names
+    // with and without "_" (for example "_itoa" but "sin").
+    if (Name.length() > 2 && Name[0] == '_')
+      if (auto SymAddr =
+              llvm::RTDyldMemoryManager::getSymbolAddressInProcess(Name.substr(1)))
+        return llvm::JITSymbol(SymAddr, llvm::JITSymbolFlags::Exported);
+#endif
+
+    return nullptr;
+  }
+
+  std::string JIT::mangle(const std::string &Name) {
+    std::string MangledName;
+    {
+      llvm::raw_string_ostream MangledNameStream(MangledName);
+      llvm::Mangler::getNameWithPrefix(MangledNameStream, Name, mDataLayout);
+    }
+    return MangledName;
+  }
+}
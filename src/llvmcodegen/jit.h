@@ -0,0 +1,87 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+//based on the KaleidoscopeJIT example from the llvm tutorial https://llvm.org/docs/tutorial/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <m_pd.h>
+
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Mangler.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace xnor {
+  //the process wide jit, every jit/expr object loads its code here
+  //so there is only one target machine, object layer and resolver.
+  //all methods are thread safe
+  class JIT {
+    public:
+      using ObjLayerT = llvm::orc::RTDyldObjectLinkingLayer;
+      using ObjectHandleT = ObjLayerT::ObjHandleT;
+
+      //LLVMCodeGenVisitor::init() must have been called before the first access
+      static JIT& instance();
+
+      //the same for every cpu
+      const llvm::DataLayout& dataLayout() const { return mDataLayout; }
+
+      //cpu is an llvm cpu name like "x86-64" or "haswell" to pin the instruction set,
+      //empty or "native" for the host cpu and all of its features.
+      //throws std::runtime_error for unknown cpus
+      llvm::TargetMachine& targetMachine(const std::string& cpu = std::string());
+      //describes everything besides the module that the object code depends on
+      std::string fingerprint(const std::string& cpu = std::string());
+
+      //compile the module to relocatable object code
+      std::unique_ptr<llvm::MemoryBuffer> compile(llvm::Module& module, const std::string& cpu = std::string());
+      //load object code into the shared object layer,
+      //name is what profilers show the code as, see Profiler
+      ObjectHandleT addObject(std::unique_ptr<llvm::MemoryBuffer> object, const std::string& name = std::string());
+      //release the code pages associated with the handle
+      void removeObject(ObjectHandleT handle);
+      //finalize the object and look up an unmangled symbol in it, 0 if not found or unresolved
+      llvm::JITTargetAddress address(ObjectHandleT handle, const std::string& name);
+
+      //symbols referenced by generated code, gensym isn't thread safe so
+      //names have to be interned from the pd thread before compiling elsewhere
+      t_symbol * intern(const std::string& name);
+      t_symbol * symbol(const std::string& name);
+      //generated code refers to symbols through external globals with this name,
+      //they are resolved when the object is loaded so it can be reused across sessions
+      static std::string symbolGlobalName(const std::string& name);
+    private:
+      JIT();
+      JIT(const JIT&) = delete;
+      JIT& operator=(const JIT&) = delete;
+
+      std::unique_ptr<llvm::TargetMachine> mTargetMachine; //the host
+      std::map<std::string, std::unique_ptr<llvm::TargetMachine>> mTargetMachines;
+      std::mutex mMachineMutex;
+      const llvm::DataLayout mDataLayout;
+      ObjLayerT mObjectLayer;
+      std::shared_ptr<llvm::JITSymbolResolver> mResolver;
+      std::mutex mMutex;
+      std::mutex mCompileMutex;
+      //names of objects that haven't been loaded yet, only kept when profiling
+      std::map<const void *, std::string> mNames;
+
+      std::map<std::string, t_symbol *> mSymbols;
+      std::string mSymbolPrefix;
+      std::mutex mSymbolMutex;
+
+      llvm::JITSymbol findMangledSymbol(const std::string& name);
+      std::string mangle(const std::string& name);
+  };
+}
@@ -0,0 +1,190 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "kernel.h"
+#include "canonical.h"
+#include "objectcache.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace xnor {
+  Kernel::Kernel(LLVMCodeGenVisitor::function_t func, JIT::ObjectHandleT handle) :
+    mFunction(func), mHandle(handle)
+  {
+  }
+
+  Kernel::~Kernel() {
+    JIT::instance().removeObject(mHandle);
+  }
+
+  KernelSlot::KernelSlot(const std::string& key, const CompileOptions& options, const std::string& name) :
+    mFunction(nullptr), mDone(false), mKey(key), mOptions(options), mName(name)
+  {
+  }
+
+  std::shared_ptr<Kernel> KernelSlot::kernel() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mKernel;
+  }
+
+  std::string KernelSlot::error() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mError;
+  }
+
+  void KernelSlot::set(std::shared_ptr<Kernel> kernel) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mKernel = kernel;
+    mStatements.clear();
+    mFunction.store(kernel->function(), std::memory_order_release);
+    mDone.store(true, std::memory_order_release);
+  }
+
+  void KernelSlot::fail(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mError = error;
+    mStatements.clear();
+    mDone.store(true, std::memory_order_release);
+  }
+
+  KernelCache& KernelCache::instance() {
+    //never destroyed, the compile thread runs until exit
+    static KernelCache * cache = new KernelCache();
+    return *cache;
+  }
+
+  std::shared_ptr<Kernel> KernelCache::get(const std::string& tag, const std::vector<ast::NodePtr>& statements, const CompileOptions& options,
+      const std::string& name) {
+    auto k = key(tag, statements, options);
+    if (auto kernel = find(k))
+      return kernel;
+    LLVMCodeGenVisitor::intern(statements);
+    return compile(k, statements, options, name);
+  }
+
+  std::shared_ptr<KernelSlot> KernelCache::slot(const std::string& tag, const std::vector<ast::NodePtr>& statements, const CompileOptions& options,
+      const std::string& name) {
+    auto k = key(tag, statements, options);
+    std::shared_ptr<KernelSlot> slot(new KernelSlot(k, options, name));
+    auto kernel = find(k);
+    //loading cached object code is cheap enough to do right away
+    if (!kernel) {
+      LLVMCodeGenVisitor::intern(statements);
+      kernel = load(k, options, name);
+    }
+    if (kernel)
+      slot->set(kernel);
+    return slot;
+  }
+
+  void KernelCache::submit(std::shared_ptr<KernelSlot> slot, const std::vector<ast::NodePtr>& statements) {
+    if (slot->done() || slot->mSubmitted)
+      return;
+    slot->mSubmitted = true;
+
+    LLVMCodeGenVisitor::intern(statements);
+    slot->mStatements = statements;
+    {
+      std::lock_guard<std::mutex> lock(mQueueMutex);
+      if (!mThreadStarted) {
+        std::thread(&KernelCache::run, this).detach();
+        mThreadStarted = true;
+      }
+      mQueue.push_back(slot);
+    }
+    mQueueCondition.notify_one();
+  }
+
+  std::string KernelCache::key(const std::string& tag, const std::vector<ast::NodePtr>& statements, const CompileOptions& options) {
+    return tag + ":" + options.key() + ":" + ast::canonical(statements);
+  }
+
+  std::shared_ptr<Kernel> KernelCache::find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mKernels.find(key);
+    if (it != mKernels.end())
+      return it->second.lock();
+    return nullptr;
+  }
+
+  std::shared_ptr<Kernel> KernelCache::compile(const std::string& key, const std::vector<ast::NodePtr>& statements, const CompileOptions& options,
+      const std::string& name) {
+    //skip codegen entirely if a previous session compiled this already
+    if (auto kernel = load(key, options, name))
+      return kernel;
+
+    auto& jit = JIT::instance();
+    LLVMCodeGenVisitor cv(options);
+    auto object = cv.object(statements);
+    ObjectCache::instance().store(objectKey(key, options), *object);
+    auto handle = jit.addObject(std::move(object), name);
+    auto kernel = std::make_shared<Kernel>(LLVMCodeGenVisitor::lookup(handle), handle);
+    add(key, kernel);
+    return kernel;
+  }
+
+  std::shared_ptr<Kernel> KernelCache::load(const std::string& key, const CompileOptions& options, const std::string& name) {
+    auto object = ObjectCache::instance().load(objectKey(key, options));
+    if (!object)
+      return nullptr;
+
+    std::shared_ptr<Kernel> kernel;
+    try {
+      auto handle = JIT::instance().addObject(std::move(object), name);
+      kernel = std::make_shared<Kernel>(LLVMCodeGenVisitor::lookup(handle), handle);
+    } catch (std::runtime_error&) {
+      //stale or corrupt, it will be compiled again
+      return nullptr;
+    }
+    add(key, kernel);
+    return kernel;
+  }
+
+  std::string KernelCache::objectKey(const std::string& key, const CompileOptions& options) {
+    return key + "\n" + JIT::instance().fingerprint(options.cpu);
+  }
+
+  void KernelCache::add(const std::string& key, std::shared_ptr<Kernel> kernel) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mKernels[key] = kernel;
+    //drop entries for kernels that are no longer used
+    if (mKernels.size() >= mSweepSize)
+      sweep();
+  }
+
+  void KernelCache::process(std::shared_ptr<KernelSlot> slot) {
+    //an identical expression might have been compiled since the slot was submitted
+    auto kernel = find(slot->mKey);
+    try {
+      if (!kernel)
+        kernel = compile(slot->mKey, slot->mStatements, slot->mOptions, slot->mName);
+      slot->set(kernel);
+    } catch (std::runtime_error& e) {
+      slot->fail(e.what());
+    }
+  }
+
+  void KernelCache::run() {
+    while (true) {
+      std::weak_ptr<KernelSlot> next;
+      {
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mQueueCondition.wait(lock, [this] { return !mQueue.empty(); });
+        next = mQueue.front();
+        mQueue.pop_front();
+      }
+      //skip objects that have been deleted while waiting
+      if (auto slot = next.lock())
+        process(slot);
+    }
+  }
+
+  void KernelCache::sweep() {
+    for (auto it = mKernels.begin(); it != mKernels.end();) {
+      if (it->second.expired())
+        it = mKernels.erase(it);
+      else
+        it++;
+    }
+    mSweepSize = std::max(static_cast<size_t>(64), mKernels.size() * 2);
+  }
+}
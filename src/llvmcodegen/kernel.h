@@ -0,0 +1,111 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include "codegen.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xnor {
+  //a compiled function in the shared jit, the code is released with the last reference
+  class Kernel {
+    public:
+      Kernel(LLVMCodeGenVisitor::function_t func, JIT::ObjectHandleT handle);
+      ~Kernel();
+
+      LLVMCodeGenVisitor::function_t function() const { return mFunction; }
+    private:
+      Kernel(const Kernel&) = delete;
+      Kernel& operator=(const Kernel&) = delete;
+
+      LLVMCodeGenVisitor::function_t mFunction;
+      JIT::ObjectHandleT mHandle;
+  };
+
+  //where an object finds its kernel, filled in by the compile thread
+  class KernelSlot {
+    public:
+      //lock free so it can be called from perform, nullptr until the kernel is ready
+      LLVMCodeGenVisitor::function_t function() const { return mFunction.load(std::memory_order_acquire); }
+      //true once the compile has either succeeded or failed
+      bool done() const { return mDone.load(std::memory_order_acquire); }
+      //true once the slot is queued for the compile thread, only used from the pd thread
+      bool submitted() const { return mSubmitted; }
+
+      std::shared_ptr<Kernel> kernel() const;
+      std::string error() const;
+    private:
+      friend class KernelCache;
+      KernelSlot(const std::string& key, const CompileOptions& options, const std::string& name);
+
+      void set(std::shared_ptr<Kernel> kernel);
+      void fail(const std::string& error);
+
+      std::atomic<LLVMCodeGenVisitor::function_t> mFunction;
+      std::atomic<bool> mDone;
+      bool mSubmitted = false;
+
+      mutable std::mutex mMutex;
+      std::shared_ptr<Kernel> mKernel;
+      std::string mError;
+
+      //what to compile, the trees are only held from submit until the compile is done
+      std::string mKey;
+      std::vector<xnor::ast::NodePtr> mStatements;
+      CompileOptions mOptions;
+      std::string mName;
+  };
+
+  //kernels keyed by the canonical form of their statements so identical
+  //expressions are only compiled once and share their code pages,
+  //the object code is also kept in the ObjectCache for later sessions
+  class KernelCache {
+    public:
+      static KernelCache& instance();
+
+      //tag distinguishes objects that should not share code, ie the object kind.
+      //name is what profilers show the code as, objects that share a kernel show the first one's.
+      //get, slot and submit must be called from the pd thread
+
+      //compile on the calling thread
+      std::shared_ptr<Kernel> get(const std::string& tag, const std::vector<xnor::ast::NodePtr>& statements,
+          const CompileOptions& options = CompileOptions(), const std::string& name = std::string());
+      //a slot for the statements, already filled in if the kernel is cached.
+      //it doesn't keep the statements, they are given again to submit
+      std::shared_ptr<KernelSlot> slot(const std::string& tag, const std::vector<xnor::ast::NodePtr>& statements,
+          const CompileOptions& options = CompileOptions(), const std::string& name = std::string());
+      //queue the slot for the compile thread with the statements it was made for,
+      //does nothing if it is done or already queued
+      void submit(std::shared_ptr<KernelSlot> slot, const std::vector<xnor::ast::NodePtr>& statements);
+    private:
+      KernelCache() { }
+
+      std::map<std::string, std::weak_ptr<Kernel>> mKernels;
+      size_t mSweepSize = 64;
+      std::mutex mMutex;
+
+      std::deque<std::weak_ptr<KernelSlot>> mQueue;
+      std::mutex mQueueMutex;
+      std::condition_variable mQueueCondition;
+      bool mThreadStarted = false;
+
+      std::string key(const std::string& tag, const std::vector<xnor::ast::NodePtr>& statements, const CompileOptions& options);
+      std::shared_ptr<Kernel> find(const std::string& key);
+      std::shared_ptr<Kernel> compile(const std::string& key, const std::vector<xnor::ast::NodePtr>& statements,
+          const CompileOptions& options, const std::string& name);
+      //from the object cache, nullptr if it isn't there
+      std::shared_ptr<Kernel> load(const std::string& key, const CompileOptions& options, const std::string& name);
+      std::string objectKey(const std::string& key, const CompileOptions& options);
+      void add(const std::string& key, std::shared_ptr<Kernel> kernel);
+      void process(std::shared_ptr<KernelSlot> slot);
+      void run();
+      void sweep();
+  };
+}
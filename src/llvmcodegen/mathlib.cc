@@ -0,0 +1,295 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "mathlib.h"
+
+#include <limits>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+using llvm::Value;
+
+namespace {
+  const float infinity = std::numeric_limits<float>::infinity();
+  const float not_a_number = std::numeric_limits<float>::quiet_NaN();
+  //floats at least this big are all integers
+  const float integral = 16777216.0f;
+
+  Value * fconst(llvm::IRBuilder<>& b, float v) { return llvm::ConstantFP::get(b.getFloatTy(), v); }
+  Value * iconst(llvm::IRBuilder<>& b, uint32_t v) { return b.getInt32(v); }
+
+  Value * bits(llvm::IRBuilder<>& b, Value * v) { return b.CreateBitCast(v, b.getInt32Ty()); }
+  Value * flt(llvm::IRBuilder<>& b, Value * v) { return b.CreateBitCast(v, b.getFloatTy()); }
+  Value * absolute(llvm::IRBuilder<>& b, Value * v) { return flt(b, b.CreateAnd(bits(b, v), iconst(b, 0x7fffffff))); }
+  Value * unordered(llvm::IRBuilder<>& b, Value * v) { return b.CreateFCmpUNO(v, v); }
+
+  //horner's scheme, coefficients from the highest degree down
+  Value * polynomial(llvm::IRBuilder<>& b, Value * x, std::initializer_list<float> coefs) {
+    auto it = coefs.begin();
+    Value * y = fconst(b, *it++);
+    for (; it != coefs.end(); it++)
+      y = b.CreateFAdd(b.CreateFMul(y, x), fconst(b, *it));
+    return y;
+  }
+}
+
+namespace xnor {
+  std::string MathLibrary::name(Accuracy accuracy) {
+    switch (accuracy) {
+      case Accuracy::PRECISE:
+        return "precise";
+      case Accuracy::FAST:
+        return "fast";
+      case Accuracy::LIBM:
+        return "libm";
+    }
+    return "";
+  }
+
+  bool MathLibrary::parse(const std::string& name, Accuracy& accuracy) {
+    for (auto a: {Accuracy::PRECISE, Accuracy::FAST, Accuracy::LIBM}) {
+      if (name == MathLibrary::name(a)) {
+        accuracy = a;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool MathLibrary::approximates(const std::string& name, Accuracy accuracy) {
+    if (accuracy == Accuracy::LIBM)
+      return false;
+    for (auto n: {"sin", "cos", "exp", "log", "ln", "log10", "tanh", "pow"}) {
+      if (name == n)
+        return true;
+    }
+    return false;
+  }
+
+  MathLibrary::MathLibrary(llvm::Module * module, Accuracy accuracy) :
+    mModule(module),
+    mAccuracy(accuracy),
+    mFloatType(llvm::Type::getFloatTy(module->getContext()))
+  {
+  }
+
+  llvm::Function * MathLibrary::function(const std::string& name) {
+    auto n = name == "ln" ? "log" : name;
+    if (mAccuracy == Accuracy::LIBM) {
+      if (n == "sin")
+        return intrinsic(llvm::Intrinsic::sin);
+      if (n == "cos")
+        return intrinsic(llvm::Intrinsic::cos);
+      if (n == "exp")
+        return intrinsic(llvm::Intrinsic::exp);
+      if (n == "log")
+        return intrinsic(llvm::Intrinsic::log);
+      if (n == "log10")
+        return intrinsic(llvm::Intrinsic::log10);
+      if (n == "pow")
+        return intrinsic(llvm::Intrinsic::pow);
+      return nullptr;
+    }
+
+    if (n == "sin")
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return sincos(b, a[0], false); });
+    if (n == "cos")
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return sincos(b, a[0], true); });
+    if (n == "exp")
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return exp(b, a[0]); });
+    if (n == "log")
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return log(b, a[0]); });
+    if (n == "log10") {
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) {
+          return b.CreateFMul(log(b, a[0]), fconst(b, 0.434294481903251828f));
+      });
+    }
+    if (n == "tanh")
+      return define(n, 1, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return tanh(b, a[0]); });
+    if (n == "pow")
+      return define(n, 2, [this](llvm::IRBuilder<>& b, const std::vector<Value *>& a) { return pow(b, a[0], a[1]); });
+    return nullptr;
+  }
+
+  llvm::Function * MathLibrary::define(const std::string& name, unsigned int argc, body_t body) {
+    auto n = "jit_expr." + name;
+    if (auto f = mModule->getFunction(n))
+      return f;
+
+    std::vector<llvm::Type *> args(argc, mFloatType);
+    auto f = llvm::Function::Create(llvm::FunctionType::get(mFloatType, args, false),
+        llvm::Function::InternalLinkage, n, mModule);
+    f->addFnAttr(llvm::Attribute::AlwaysInline);
+    f->addFnAttr(llvm::Attribute::ReadNone);
+    f->addFnAttr(llvm::Attribute::NoUnwind);
+
+    //a builder of our own, the caller's fast math flags must not reassociate the range reductions
+    llvm::IRBuilder<> b(llvm::BasicBlock::Create(mModule->getContext(), "entry", f));
+    std::vector<Value *> values;
+    for (auto& a: f->args())
+      values.push_back(&a);
+    b.CreateRet(body(b, values));
+    return f;
+  }
+
+  llvm::Function * MathLibrary::intrinsic(llvm::Intrinsic::ID id) {
+    return llvm::Intrinsic::getDeclaration(mModule, id, {mFloatType});
+  }
+
+  Value * MathLibrary::sincos(llvm::IRBuilder<>& b, Value * xin, bool cosine) {
+    bool fast = mAccuracy == Accuracy::FAST;
+
+    //j is the octant of |x| rounded up to even, y the multiple of pi/4 it starts at
+    auto x = absolute(b, xin);
+    Value * j = b.CreateFPToSI(b.CreateFMul(x, fconst(b, 1.27323954473516f)), b.getInt32Ty());
+    j = b.CreateAnd(b.CreateAdd(j, iconst(b, 1)), iconst(b, ~1u));
+    auto y = b.CreateSIToFP(j, mFloatType);
+
+    //cos(x) = sin(x + pi/2), the sign comes from the octant and for sin, the sign of x
+    Value * sign = nullptr;
+    if (cosine) {
+      j = b.CreateSub(j, iconst(b, 2));
+      sign = b.CreateShl(b.CreateAnd(b.CreateNot(j), iconst(b, 4)), 29);
+    } else {
+      sign = b.CreateXor(b.CreateAnd(bits(b, xin), iconst(b, 0x80000000)),
+          b.CreateShl(b.CreateAnd(j, iconst(b, 4)), 29));
+    }
+    auto usesin = b.CreateICmpEQ(b.CreateAnd(j, iconst(b, 2)), iconst(b, 0));
+
+    //x - y * pi/4, in three parts so it is exact in the precise version
+    if (fast) {
+      x = b.CreateFSub(x, b.CreateFMul(y, fconst(b, 0.78539816339744830962f)));
+    } else {
+      x = b.CreateFSub(x, b.CreateFMul(y, fconst(b, 0.78515625f)));
+      x = b.CreateFSub(x, b.CreateFMul(y, fconst(b, 2.4187564849853515625e-4f)));
+      x = b.CreateFSub(x, b.CreateFMul(y, fconst(b, 3.77489497744594108e-8f)));
+    }
+
+    //both polynomials on -pi/4..pi/4, one of them is picked
+    auto z = b.CreateFMul(x, x);
+    Value * ys = nullptr;
+    Value * yc = nullptr;
+    if (fast) {
+      ys = polynomial(b, z, {8.3333333333e-3f, -1.6666666666e-1f});
+      yc = polynomial(b, z, {-1.3888888888e-3f, 4.1666666666e-2f});
+    } else {
+      ys = polynomial(b, z, {-1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f});
+      yc = polynomial(b, z, {2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f});
+    }
+    ys = b.CreateFAdd(b.CreateFMul(b.CreateFMul(ys, z), x), x);
+    yc = b.CreateFMul(b.CreateFMul(yc, z), z);
+    yc = b.CreateFAdd(b.CreateFSub(yc, b.CreateFMul(z, fconst(b, 0.5f))), fconst(b, 1.0f));
+
+    Value * r = b.CreateSelect(usesin, ys, yc);
+    r = flt(b, b.CreateXor(bits(b, r), sign));
+    //infinities and nans
+    return b.CreateSelect(b.CreateFCmpOLT(absolute(b, xin), fconst(b, infinity)), r, fconst(b, not_a_number));
+  }
+
+  Value * MathLibrary::exp(llvm::IRBuilder<>& b, Value * xin) {
+    bool fast = mAccuracy == Accuracy::FAST;
+
+    //clamp so the power of two below is a normal float, results under FLT_MIN flush to 0
+    const float hi = 88.3762626647949f;
+    const float lo = -88.3762626647949f;
+    Value * x = b.CreateSelect(b.CreateFCmpOLT(xin, fconst(b, hi)), xin, fconst(b, hi));
+    x = b.CreateSelect(b.CreateFCmpOGT(x, fconst(b, lo)), x, fconst(b, lo));
+
+    //exp(x) = 2^n * exp(x - n * ln 2), n = floor(x / ln 2 + 0.5)
+    Value * fx = b.CreateFAdd(b.CreateFMul(x, fconst(b, 1.44269504088896341f)), fconst(b, 0.5f));
+    auto n = b.CreateFPToSI(fx, b.getInt32Ty());
+    auto t = b.CreateSIToFP(n, mFloatType);
+    auto above = b.CreateFCmpOGT(t, fx);
+    n = b.CreateSub(n, b.CreateZExt(above, b.getInt32Ty()));
+    fx = b.CreateFSub(t, b.CreateSelect(above, fconst(b, 1.0f), fconst(b, 0.0f)));
+    x = b.CreateFSub(x, b.CreateFMul(fx, fconst(b, 0.693359375f)));
+    x = b.CreateFSub(x, b.CreateFMul(fx, fconst(b, -2.12194440e-4f)));
+
+    auto z = b.CreateFMul(x, x);
+    Value * y = nullptr;
+    if (fast)
+      y = polynomial(b, x, {4.1666666666e-2f, 1.6666666666e-1f, 0.5f});
+    else
+      y = polynomial(b, x, {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f});
+    y = b.CreateFAdd(b.CreateFAdd(b.CreateFMul(y, z), x), fconst(b, 1.0f));
+
+    auto pow2n = flt(b, b.CreateShl(b.CreateAdd(n, iconst(b, 127)), 23));
+    y = b.CreateFMul(y, pow2n);
+    y = b.CreateSelect(b.CreateFCmpOGT(xin, fconst(b, 88.72283905206835f)), fconst(b, infinity), y);
+    return b.CreateSelect(unordered(b, xin), xin, y);
+  }
+
+  Value * MathLibrary::log(llvm::IRBuilder<>& b, Value * xin) {
+    bool fast = mAccuracy == Accuracy::FAST;
+
+    //scale denormals up so they have an exponent
+    auto denormal = b.CreateFCmpOLT(xin, fconst(b, std::numeric_limits<float>::min()));
+    auto x = b.CreateSelect(denormal, b.CreateFMul(xin, fconst(b, 8388608.0f)), xin);
+
+    //x = m * 2^e with m in sqrt(0.5)..sqrt(2), then log(x) = log(m) + e * ln 2
+    auto u = bits(b, x);
+    Value * e = b.CreateSIToFP(b.CreateSub(b.CreateLShr(u, 23), iconst(b, 126)), mFloatType);
+    e = b.CreateFSub(e, b.CreateSelect(denormal, fconst(b, 23.0f), fconst(b, 0.0f)));
+    Value * m = flt(b, b.CreateOr(b.CreateAnd(u, iconst(b, 0x807fffff)), iconst(b, 0x3f000000)));
+    auto small = b.CreateFCmpOLT(m, fconst(b, 0.707106781186547524f));
+    e = b.CreateFSub(e, b.CreateSelect(small, fconst(b, 1.0f), fconst(b, 0.0f)));
+    m = b.CreateFAdd(b.CreateFSub(m, fconst(b, 1.0f)), b.CreateSelect(small, m, fconst(b, 0.0f)));
+
+    Value * r = nullptr;
+    if (fast) {
+      //log(1 + m) = 2 atanh(m / (2 + m))
+      auto s = b.CreateFDiv(m, b.CreateFAdd(m, fconst(b, 2.0f)));
+      auto s2 = b.CreateFMul(s, s);
+      r = b.CreateFMul(b.CreateFMul(s, fconst(b, 2.0f)), polynomial(b, s2, {2.0e-1f, 3.3333333333e-1f, 1.0f}));
+      r = b.CreateFAdd(r, b.CreateFMul(e, fconst(b, 0.693147180559945f)));
+    } else {
+      auto z = b.CreateFMul(m, m);
+      Value * y = polynomial(b, m, {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f,
+          1.4249322787e-1f, -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f});
+      y = b.CreateFMul(b.CreateFMul(y, m), z);
+      y = b.CreateFAdd(y, b.CreateFMul(e, fconst(b, -2.12194440e-4f)));
+      y = b.CreateFSub(y, b.CreateFMul(z, fconst(b, 0.5f)));
+      r = b.CreateFAdd(b.CreateFAdd(m, y), b.CreateFMul(e, fconst(b, 0.693359375f)));
+    }
+
+    r = b.CreateSelect(b.CreateFCmpOEQ(xin, fconst(b, infinity)), xin, r);
+    r = b.CreateSelect(b.CreateFCmpOEQ(xin, fconst(b, 0.0f)), fconst(b, -infinity), r);
+    r = b.CreateSelect(b.CreateFCmpOLT(xin, fconst(b, 0.0f)), fconst(b, not_a_number), r);
+    return b.CreateSelect(unordered(b, xin), xin, r);
+  }
+
+  Value * MathLibrary::tanh(llvm::IRBuilder<>& b, Value * x) {
+    //tanh(|x|) = 1 - 2 / (exp(2|x|) + 1), with the sign of x
+    auto e = b.CreateCall(function("exp"), {b.CreateFMul(absolute(b, x), fconst(b, 2.0f))});
+    Value * t = b.CreateFSub(fconst(b, 1.0f), b.CreateFDiv(fconst(b, 2.0f), b.CreateFAdd(e, fconst(b, 1.0f))));
+    t = flt(b, b.CreateOr(bits(b, t), b.CreateAnd(bits(b, x), iconst(b, 0x80000000))));
+    t = b.CreateSelect(unordered(b, x), x, t);
+    if (mAccuracy == Accuracy::FAST)
+      return t;
+
+    //the subtraction loses precision near 0, use a polynomial there
+    auto z = b.CreateFMul(x, x);
+    Value * p = polynomial(b, z, {-5.70498872745e-3f, 2.06390887954e-2f, -5.37397155531e-2f, 1.33314422036e-1f, -3.33332819422e-1f});
+    p = b.CreateFAdd(b.CreateFMul(b.CreateFMul(p, z), x), x);
+    return b.CreateSelect(b.CreateFCmpOLT(absolute(b, x), fconst(b, 0.625f)), p, t);
+  }
+
+  Value * MathLibrary::pow(llvm::IRBuilder<>& b, Value * x, Value * y) {
+    //|x|^y = exp(y * log(|x|)), the error grows with |y * log(x)|
+    auto l = b.CreateCall(function("log"), {absolute(b, x)});
+    Value * r = b.CreateCall(function("exp"), {b.CreateFMul(y, l)});
+
+    //negative x needs an integer y, odd ones keep the sign
+    auto issmall = b.CreateFCmpOLT(absolute(b, y), fconst(b, integral));
+    auto iy = b.CreateSelect(issmall, b.CreateFPToSI(y, b.getInt32Ty()), iconst(b, 0));
+    auto isint = b.CreateOr(b.CreateNot(issmall), b.CreateFCmpOEQ(b.CreateSIToFP(iy, mFloatType), y));
+    auto odd = b.CreateICmpNE(b.CreateAnd(iy, iconst(b, 1)), iconst(b, 0));
+    auto neg = b.CreateSelect(isint, b.CreateSelect(odd, b.CreateFNeg(r), r), fconst(b, not_a_number));
+    r = b.CreateSelect(b.CreateFCmpOLT(x, fconst(b, 0.0f)), neg, r);
+
+    //pow(x, 0) and pow(1, y) are 1 even for nans
+    r = b.CreateSelect(b.CreateFCmpOEQ(y, fconst(b, 0.0f)), fconst(b, 1.0f), r);
+    return b.CreateSelect(b.CreateFCmpOEQ(x, fconst(b, 1.0f)), fconst(b, 1.0f), r);
+  }
+}
@@ -0,0 +1,59 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+
+namespace llvm {
+  class Module;
+  class Function;
+  class Value;
+}
+
+namespace xnor {
+  //float versions of the expensive libm functions generated as llvm ir. unlike calls into libm
+  //they are inlined, constant folded and vectorized along with the rest of the sample loop.
+  //the polynomials are the cephes single precision ones, see http://www.netlib.org/cephes/
+  class MathLibrary {
+    public:
+      enum class Accuracy {
+        PRECISE, //within a few ulp of libm, sin and cos are reduced exactly for |x| < 8192
+        FAST, //around 1e-5 relative error, shorter polynomials and range reduction
+        LIBM //call libm, the intrinsics still allow constant folding but block vectorization
+      };
+
+      //the name used in options and messages
+      static std::string name(Accuracy accuracy);
+      //false if the name isn't an accuracy
+      static bool parse(const std::string& name, Accuracy& accuracy);
+      //true if the expr function is computed with a polynomial rather than libm at this accuracy
+      static bool approximates(const std::string& name, Accuracy accuracy);
+
+      MathLibrary(llvm::Module * module, Accuracy accuracy);
+
+      //the function that computes the expr function name with float arguments and result,
+      //nullptr if there isn't one at this accuracy
+      llvm::Function * function(const std::string& name);
+    private:
+      typedef std::function<llvm::Value *(llvm::IRBuilder<>& b, const std::vector<llvm::Value *>& args)> body_t;
+
+      llvm::Module * mModule;
+      Accuracy mAccuracy;
+      llvm::Type * mFloatType;
+
+      //an internal always inline function in the module, created on first use
+      llvm::Function * define(const std::string& name, unsigned int argc, body_t body);
+      llvm::Function * intrinsic(llvm::Intrinsic::ID id);
+
+      llvm::Value * sincos(llvm::IRBuilder<>& b, llvm::Value * x, bool cosine);
+      llvm::Value * exp(llvm::IRBuilder<>& b, llvm::Value * x);
+      llvm::Value * log(llvm::IRBuilder<>& b, llvm::Value * x);
+      llvm::Value * tanh(llvm::IRBuilder<>& b, llvm::Value * x);
+      llvm::Value * pow(llvm::IRBuilder<>& b, llvm::Value * x, llvm::Value * y);
+  };
+}
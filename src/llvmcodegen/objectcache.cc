@@ -0,0 +1,106 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "objectcache.h"
+#include "jit_expr_version.h"
+#include "jit_expr_codegen.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+  //bump when the layout of the cache files changes, changes to the generated code or the
+  //kernel calling convention are covered by JIT_EXPR_CODEGEN_HASH
+  const int cache_format = 7;
+
+  //stable across builds, unlike std::hash
+  uint64_t fnv1a(const std::string& s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: s) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+}
+
+namespace xnor {
+  ObjectCache& ObjectCache::instance() {
+    static ObjectCache * cache = new ObjectCache();
+    return *cache;
+  }
+
+  ObjectCache::ObjectCache() {
+    llvm::SmallString<256> dir;
+    if (const char * env = std::getenv("JIT_EXPR_CACHE_DIR")) {
+      dir = env;
+    } else if (!llvm::sys::path::user_cache_directory(dir, "jit_expr", "objects")) {
+      return;
+    }
+    if (dir.empty() || llvm::sys::fs::create_directories(dir))
+      return;
+    mDirectory = dir.str().str();
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> ObjectCache::load(const std::string& key) {
+    if (mDirectory.empty())
+      return nullptr;
+    auto file = llvm::MemoryBuffer::getFile(path(key));
+    if (!file)
+      return nullptr;
+
+    //the full key is stored so hash collisions are misses
+    auto data = (*file)->getBuffer();
+    auto h = header(key);
+    if (!data.startswith(h))
+      return nullptr;
+    return llvm::MemoryBuffer::getMemBufferCopy(data.substr(h.size()));
+  }
+
+  void ObjectCache::store(const std::string& key, const llvm::MemoryBuffer& object) {
+    if (mDirectory.empty())
+      return;
+
+    //write to a temporary and rename so other pd instances never see a partial entry
+    auto p = path(key);
+    llvm::SmallString<256> tmp;
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(p + ".%%%%%%.tmp", fd, tmp))
+      return;
+    {
+      llvm::raw_fd_ostream out(fd, true);
+      out << header(key);
+      out.write(object.getBufferStart(), object.getBufferSize());
+      out.close();
+      if (out.has_error()) {
+        out.clear_error();
+        llvm::sys::fs::remove(tmp);
+        return;
+      }
+    }
+    if (llvm::sys::fs::rename(tmp, p))
+      llvm::sys::fs::remove(tmp);
+  }
+
+  std::string ObjectCache::path(const std::string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.o", static_cast<unsigned long long>(fnv1a(key)));
+    llvm::SmallString<256> p(mDirectory);
+    llvm::sys::path::append(p, name);
+    return p.str().str();
+  }
+
+  std::string ObjectCache::header(const std::string& key) {
+    return "jit_expr "
+      + std::to_string(JIT_EXPR_VERSION_MAJOR) + "."
+      + std::to_string(JIT_EXPR_VERSION_MINOR) + "."
+      + std::to_string(JIT_EXPR_VERSION_PATCH)
+      + " object cache " + std::to_string(cache_format) + " " JIT_EXPR_CODEGEN_HASH "\n"
+      + std::to_string(key.size()) + "\n" + key;
+  }
+}
@@ -0,0 +1,33 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace xnor {
+  //object code saved on disk so expressions don't have to be compiled again
+  //in the next pd session. the directory is $JIT_EXPR_CACHE_DIR if it is set,
+  //an empty value disables the cache, otherwise the user's cache directory.
+  //everything is best effort, failures just mean we compile again
+  class ObjectCache {
+    public:
+      static ObjectCache& instance();
+
+      //the key must describe everything the object code depends on,
+      //nullptr if there isn't a valid entry for it
+      std::unique_ptr<llvm::MemoryBuffer> load(const std::string& key);
+      void store(const std::string& key, const llvm::MemoryBuffer& object);
+    private:
+      ObjectCache();
+      ObjectCache(const ObjectCache&) = delete;
+      ObjectCache& operator=(const ObjectCache&) = delete;
+
+      std::string mDirectory; //empty if disabled
+
+      std::string path(const std::string& key) const;
+      static std::string header(const std::string& key);
+  };
+}
@@ -0,0 +1,226 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "profiler.h"
+#include "codegen.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+
+#include <llvm/Object/SymbolSize.h>
+
+#ifdef __linux__
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+  //https://github.com/torvalds/linux/blob/master/tools/perf/Documentation/jitdump-specification.txt
+  const uint32_t jitdump_magic = 0x4A695444;
+  const uint32_t jitdump_version = 1;
+  const uint32_t jitdump_code_load = 0;
+
+  struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+  };
+
+  struct jitdump_code_load_record {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    //followed by the name and the code
+  };
+
+  uint32_t elf_machine() {
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#else
+    return EM_NONE;
+#endif
+  }
+
+  //perf record -k mono uses the same clock
+  uint64_t timestamp() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+  }
+#endif
+}
+
+namespace xnor {
+  Profiler& Profiler::instance() {
+    static Profiler * profiler = new Profiler();
+    return *profiler;
+  }
+
+  Profiler::Profiler() {
+    const char * env = std::getenv("JIT_EXPR_PROFILE");
+    if (!env)
+      return;
+
+    std::stringstream ss(env);
+    std::string name;
+    while (std::getline(ss, name, ',')) {
+      llvm::JITEventListener * l = nullptr;
+      if (name == "gdb") {
+        l = llvm::JITEventListener::createGDBRegistrationListener();
+      } else if (name == "intel") {
+        l = llvm::JITEventListener::createIntelJITEventListener();
+      } else if (name == "oprofile") {
+        l = llvm::JITEventListener::createOProfileJITEventListener();
+#ifdef __linux__
+      } else if (name == "perfmap" && !mPerfMap) {
+        mPerfMap = fopen(("/tmp/perf-" + std::to_string(getpid()) + ".map").c_str(), "w");
+        mEnabled = mEnabled || mPerfMap;
+      } else if (name == "jitdump" && !mJitDump) {
+        openJitDump();
+        mEnabled = mEnabled || mJitDump;
+#endif
+      }
+      if (l) {
+        mListeners.push_back(l);
+        mEnabled = true;
+      }
+    }
+  }
+
+  void Profiler::loaded(const void * key, const std::string& name, const ObjectPtr& object,
+      const llvm::RuntimeDyld::LoadedObjectInfo& info) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& obj = *object->getBinary();
+    for (auto l: mListeners)
+      l->NotifyObjectEmitted(obj, info);
+    if (mListeners.size())
+      mObjects[key] = object;
+
+    if (!mPerfMap && !mJitDump)
+      return;
+
+    //the debug object has the addresses the sections were loaded at
+    auto debug = info.getObjectForDebug(obj);
+    if (!debug.getBinary())
+      return;
+    auto& functions = mPending[key];
+    for (auto& s: llvm::object::computeSymbolSizes(*debug.getBinary())) {
+      auto type = s.first.getType();
+      if (!type) {
+        llvm::consumeError(type.takeError());
+        continue;
+      }
+      auto symbol = s.first.getName();
+      auto address = s.first.getAddress();
+      if (*type != llvm::object::SymbolRef::ST_Function || !symbol || !address || s.second == 0) {
+        if (!symbol)
+          llvm::consumeError(symbol.takeError());
+        if (!address)
+          llvm::consumeError(address.takeError());
+        continue;
+      }
+
+      std::string n = symbol->str();
+      if (name.size())
+        n = n == LLVMCodeGenVisitor::mainFunctionName() ? name : name + " " + n;
+      functions.push_back({n, *address, s.second});
+    }
+  }
+
+  void Profiler::finalized(const void * key) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mPending.find(key);
+    if (it == mPending.end())
+      return;
+    for (auto& f: it->second) {
+      if (mPerfMap) {
+        fprintf(mPerfMap, "%llx %llx %s\n", static_cast<unsigned long long>(f.address),
+            static_cast<unsigned long long>(f.size), f.name.c_str());
+        fflush(mPerfMap);
+      }
+      if (mJitDump)
+        writeJitDump(f);
+    }
+    mPending.erase(it);
+  }
+
+  void Profiler::freed(const void * key) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPending.erase(key);
+    //perf keeps the old names, jitdump's timestamps tell reused addresses apart
+    auto it = mObjects.find(key);
+    if (it == mObjects.end())
+      return;
+    for (auto l: mListeners)
+      l->NotifyFreeingObject(*it->second->getBinary());
+    mObjects.erase(it);
+  }
+
+  void Profiler::openJitDump() {
+#ifdef __linux__
+    std::string dir = ".";
+    if (const char * env = std::getenv("JIT_EXPR_JITDUMP_DIR"))
+      dir = env;
+    mJitDump = fopen((dir + "/jit-" + std::to_string(getpid()) + ".dump").c_str(), "w+");
+    if (!mJitDump)
+      return;
+
+    jitdump_header h = {};
+    h.magic = jitdump_magic;
+    h.version = jitdump_version;
+    h.total_size = sizeof(h);
+    h.elf_mach = elf_machine();
+    h.pid = getpid();
+    h.timestamp = timestamp();
+    fwrite(&h, sizeof(h), 1, mJitDump);
+    fflush(mJitDump);
+
+    //perf finds the dump through an executable mapping of it in the recording
+    mJitDumpMarker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(mJitDump), 0);
+    if (mJitDumpMarker == MAP_FAILED) {
+      mJitDumpMarker = nullptr;
+      fclose(mJitDump);
+      mJitDump = nullptr;
+    }
+#endif
+  }
+
+  void Profiler::writeJitDump(const Function& f) {
+#ifdef __linux__
+    jitdump_code_load_record r = {};
+    r.id = jitdump_code_load;
+    r.total_size = static_cast<uint32_t>(sizeof(r) + f.name.size() + 1 + f.size);
+    r.timestamp = timestamp();
+    r.pid = getpid();
+    r.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    r.vma = f.address;
+    r.code_addr = f.address;
+    r.code_size = f.size;
+    r.code_index = mCodeIndex++;
+    fwrite(&r, sizeof(r), 1, mJitDump);
+    fwrite(f.name.c_str(), f.name.size() + 1, 1, mJitDump);
+    fwrite(reinterpret_cast<const void *>(static_cast<uintptr_t>(f.address)), f.size, 1, mJitDump);
+    fflush(mJitDump);
+#endif
+  }
+}
@@ -0,0 +1,64 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+
+namespace xnor {
+  //tells profilers where kernels are loaded so their samples are attributed to expressions
+  //instead of anonymous addresses. $JIT_EXPR_PROFILE is a comma separated list of:
+  //  perfmap: /tmp/perf-<pid>.map, read by perf report
+  //  jitdump: jit-<pid>.dump in $JIT_EXPR_JITDUMP_DIR or the current directory, with the code
+  //    so perf inject --jit can annotate it, record with perf record -k mono
+  //  gdb, intel, oprofile: llvm's jit event listeners, intel and oprofile only if llvm has them
+  //nothing is registered without it
+  class Profiler {
+    public:
+      typedef std::shared_ptr<llvm::object::OwningBinary<llvm::object::ObjectFile>> ObjectPtr;
+
+      static Profiler& instance();
+      bool enabled() const { return mEnabled; }
+
+      //the jit calls these with its lock held, key identifies the object until it is freed.
+      //name is what the kernel is shown as, its other functions get their symbol appended
+      void loaded(const void * key, const std::string& name, const ObjectPtr& object,
+          const llvm::RuntimeDyld::LoadedObjectInfo& info);
+      //relocations are applied, so the code can be copied
+      void finalized(const void * key);
+      void freed(const void * key);
+    private:
+      Profiler();
+      Profiler(const Profiler&) = delete;
+      Profiler& operator=(const Profiler&) = delete;
+
+      struct Function {
+        std::string name;
+        uint64_t address;
+        uint64_t size;
+      };
+
+      bool mEnabled = false;
+      std::mutex mMutex;
+      std::vector<llvm::JITEventListener *> mListeners;
+      std::map<const void *, ObjectPtr> mObjects; //kept for NotifyFreeingObject
+      std::map<const void *, std::vector<Function>> mPending; //loaded but not finalized
+
+      FILE * mPerfMap = nullptr;
+      FILE * mJitDump = nullptr;
+      void * mJitDumpMarker = nullptr;
+      uint64_t mCodeIndex = 0;
+
+      void openJitDump();
+      void writeJitDump(const Function& f);
+  };
+}
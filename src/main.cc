@@ -46,8 +46,7 @@ int main(int argc, char * argv[]) {
       in[0].flt = 53.2;
 
       xnor::LLVMCodeGenVisitor cv;
-      std::string s;
-      auto f = cv.function(t, s);
+      auto f = cv.function(t);
       f(&out.front(), in, 2);
       cout << "output " << value[0] << endl;
       cout << endl;
@@ -0,0 +1,47 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "arena.h"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+  //a few hundred nodes
+  const std::size_t block_size = 16384;
+}
+
+namespace xnor {
+  namespace ast {
+    Arena::~Arena() {
+      for (auto b: mBlocks)
+        std::free(b);
+    }
+
+    void * Arena::allocate(std::size_t size, std::size_t align) {
+      //big requests get their own block, in front so the current block stays open
+      if (size + align > block_size) {
+        char * b = static_cast<char *>(std::malloc(size + align));
+        if (!b)
+          throw std::bad_alloc();
+        mBlocks.insert(mBlocks.begin(), b);
+        std::size_t offset = (align - reinterpret_cast<std::uintptr_t>(b) % align) % align;
+        return b + offset;
+      }
+
+      std::size_t offset = mUsed;
+      if (mBlocks.size()) {
+        auto p = reinterpret_cast<std::uintptr_t>(mBlocks.back()) + offset;
+        offset += (align - p % align) % align;
+      }
+      if (mBlocks.empty() || offset + size > block_size) {
+        char * b = static_cast<char *>(std::malloc(block_size));
+        if (!b)
+          throw std::bad_alloc();
+        mBlocks.push_back(b);
+        offset = (align - reinterpret_cast<std::uintptr_t>(b) % align) % align;
+      }
+      mUsed = offset + size;
+      return mBlocks.back() + offset;
+    }
+  }
+}
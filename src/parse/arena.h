@@ -0,0 +1,104 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#ifndef XNOR_ARENA_H
+#define XNOR_ARENA_H
+
+#include "ast.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace xnor {
+  namespace ast {
+    //memory for the nodes of a parse, handed out from large blocks that are only freed
+    //together once the last node is gone. not thread safe, only the parser allocates
+    class Arena {
+      public:
+        Arena() { }
+        ~Arena();
+        void * allocate(std::size_t size, std::size_t align);
+      private:
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        std::vector<char *> mBlocks;
+        std::size_t mUsed = 0;
+    };
+
+    //allocator for std::allocate_shared, every node keeps its arena alive
+    template <typename T>
+      class ArenaAllocator {
+        public:
+          typedef T value_type;
+
+          ArenaAllocator(std::shared_ptr<Arena> arena) : mArena(arena) { }
+          template <typename U>
+            ArenaAllocator(const ArenaAllocator<U>& other) : mArena(other.arena()) { }
+
+          T * allocate(std::size_t n) { return static_cast<T *>(mArena->allocate(n * sizeof(T), alignof(T))); }
+          void deallocate(T * /*p*/, std::size_t /*n*/) { }
+
+          std::shared_ptr<Arena> arena() const { return mArena; }
+        private:
+          std::shared_ptr<Arena> mArena;
+      };
+
+    template <typename T, typename U>
+      bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+    template <typename T, typename U>
+      bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return !(a == b); }
+
+    //the arguments a node is made from identify it, children by address since equal children
+    //are already shared. floats are compared by their bits so 0 and -0 stay apart
+    inline std::uint32_t key_arg(float v) {
+      std::uint32_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      return bits;
+    }
+    template <typename T>
+      const T& key_arg(const T& v) { return v; }
+
+    template <typename... Args>
+      using NodeKey = std::tuple<typename std::decay<decltype(key_arg(std::declval<const typename std::decay<Args>::type&>()))>::type...>;
+
+    //hash of a NodeKey, enums hash as their values, std::hash doesn't cover them before c++14
+    struct NodeKeyHash {
+      template <typename T>
+        static typename std::enable_if<std::is_enum<T>::value, std::size_t>::type hash(const T& v) {
+          return std::hash<typename std::underlying_type<T>::type>()(static_cast<typename std::underlying_type<T>::type>(v));
+        }
+      template <typename T>
+        static typename std::enable_if<!std::is_enum<T>::value, std::size_t>::type hash(const T& v) {
+          return std::hash<T>()(v);
+        }
+      template <typename T>
+        static std::size_t hash(const std::vector<T>& v) {
+          std::size_t h = v.size();
+          for (auto& i: v)
+            h = combine(h, hash(i));
+          return h;
+        }
+
+      static std::size_t combine(std::size_t seed, std::size_t h) {
+        return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+      }
+
+      template <std::size_t I, typename... T>
+        static typename std::enable_if<I == sizeof...(T), std::size_t>::type hash_from(const std::tuple<T...>& /*t*/) { return 0; }
+      template <std::size_t I, typename... T>
+        static typename std::enable_if<I < sizeof...(T), std::size_t>::type hash_from(const std::tuple<T...>& t) {
+          return combine(hash(std::get<I>(t)), hash_from<I + 1>(t));
+        }
+
+      template <typename... T>
+        std::size_t operator()(const std::tuple<T...>& t) const { return hash_from<0>(t); }
+    };
+  }
+}
+#endif
@@ -76,12 +76,17 @@ namespace {
     {"sqrt", {ot::FLOAT}},
     {"sum", {ot::STRING}},
     {"tan", {ot::FLOAT}},
+    {"tanh", {ot::FLOAT}},
     {"trunc", {ot::FLOAT}},
   };
 }
 
 namespace xnor {
 namespace ast {
+  const std::set<std::string> impure_functions = {
+    "random", "Sum", "sum", "size"
+  };
+
   Node::~Node() {
   }
 
@@ -209,5 +214,47 @@ namespace ast {
   Node::OutputType Deref::output_type() const {
     return mValue->output_type();
   }
+
+  void RecursiveVisitor::visit(Variable* /*v*/) { }
+  void RecursiveVisitor::visit(Value<int>* /*v*/) { }
+  void RecursiveVisitor::visit(Value<float>* /*v*/) { }
+  void RecursiveVisitor::visit(Value<std::string>* /*v*/) { }
+
+  void RecursiveVisitor::visit(Quoted* v) {
+    if (v->variable())
+      v->variable()->accept(this);
+  }
+
+  void RecursiveVisitor::visit(UnaryOp* v) { v->node()->accept(this); }
+
+  void RecursiveVisitor::visit(BinaryOp* v) {
+    v->left()->accept(this);
+    v->right()->accept(this);
+  }
+
+  void RecursiveVisitor::visit(FunctionCall* v) {
+    for (auto a: v->args())
+      a->accept(this);
+  }
+
+  void RecursiveVisitor::visit(SampleAccess* v) {
+    v->source()->accept(this);
+    v->index_node()->accept(this);
+  }
+
+  void RecursiveVisitor::visit(ArrayAccess* v) {
+    if (v->name_var())
+      v->name_var()->accept(this);
+    v->index_node()->accept(this);
+  }
+
+  void RecursiveVisitor::visit(ValueAssignment* v) { v->value_node()->accept(this); }
+
+  void RecursiveVisitor::visit(ArrayAssignment* v) {
+    v->array()->accept(this);
+    v->value_node()->accept(this);
+  }
+
+  void RecursiveVisitor::visit(Deref* v) { v->value_node()->accept(this); }
 }
 }
@@ -7,6 +7,7 @@
 #include <vector>
 #include <memory>
 #include <functional>
+#include <set>
 
 namespace xnor {
   namespace ast {
@@ -32,6 +33,9 @@ namespace xnor {
 
     typedef std::vector<xnor::ast::VariablePtr> VariableVector;
 
+    //functions that read state which can change between calls, they are never folded or hoisted
+    extern const std::set<std::string> impure_functions;
+
     class Visitor {
       public:
         virtual ~Visitor(){}
@@ -50,6 +54,24 @@ namespace xnor {
         virtual void visit(Deref* v) = 0;
     };
 
+    //visits every child node, override the nodes you're interested in
+    class RecursiveVisitor : public Visitor {
+      public:
+        virtual void visit(Variable* v);
+        virtual void visit(Value<int>* v);
+        virtual void visit(Value<float>* v);
+        virtual void visit(Value<std::string>* v);
+        virtual void visit(Quoted* v);
+        virtual void visit(UnaryOp* v);
+        virtual void visit(BinaryOp* v);
+        virtual void visit(FunctionCall* v);
+        virtual void visit(SampleAccess* v);
+        virtual void visit(ArrayAccess* v);
+        virtual void visit(ValueAssignment* v);
+        virtual void visit(ArrayAssignment* v);
+        virtual void visit(Deref* v);
+    };
+
     class Node {
       public:
         virtual ~Node();
@@ -97,13 +119,12 @@ namespace xnor {
     template <typename T>
       class Value : public VNode<Value<T>> {
         public:
-          Value(const T& v) : mValue(v) { }
+          Value(const T& v, Node::OutputType t = Node::OutputType::FLOAT) : mValue(v), mOutputType(t) { }
           T value() const { return mValue; }
-          void output_type(Node::OutputType v) { mOutputType = v; }
           virtual Node::OutputType output_type() const override { return mOutputType; }
         private:
           T mValue;
-          Node::OutputType mOutputType = Node::OutputType::FLOAT;
+          Node::OutputType mOutputType;
       };
 
     class Quoted : public VNode<Quoted> {
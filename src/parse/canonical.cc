@@ -0,0 +1,146 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#include "canonical.h"
+#include <cstdio>
+
+namespace a = xnor::ast;
+
+namespace {
+  class CanonicalVisitor : public a::Visitor {
+    public:
+      CanonicalVisitor(std::string& out) : mOut(out) { }
+
+      virtual void visit(a::Variable* v) {
+        const char * t = "?";
+        switch (v->type()) {
+          case a::Variable::VarType::FLOAT:
+            t = "f"; break;
+          case a::Variable::VarType::INT:
+            t = "i"; break;
+          case a::Variable::VarType::SYMBOL:
+            t = "s"; break;
+          case a::Variable::VarType::VECTOR:
+            t = "v"; break;
+          case a::Variable::VarType::INPUT:
+            t = "x"; break;
+          case a::Variable::VarType::OUTPUT:
+            t = "y"; break;
+        }
+        mOut += "$";
+        mOut += t;
+        mOut += std::to_string(v->input_index());
+      }
+
+      virtual void visit(a::Value<int>* v) {
+        mOut += "i" + std::to_string(v->value());
+      }
+
+      virtual void visit(a::Value<float>* v) {
+        //hex float so the value round trips exactly
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%a", static_cast<double>(v->value()));
+        mOut += "f";
+        mOut += buf;
+      }
+
+      virtual void visit(a::Value<std::string>* v) {
+        name("n", v->value());
+      }
+
+      virtual void visit(a::Quoted* v) {
+        if (v->value().size()) {
+          name("q", v->value());
+        } else {
+          open("q");
+          child(v->variable());
+          close();
+        }
+      }
+
+      virtual void visit(a::UnaryOp* v) {
+        open("u" + std::to_string(static_cast<int>(v->op())));
+        child(v->node());
+        close();
+      }
+
+      virtual void visit(a::BinaryOp* v) {
+        open("b" + std::to_string(static_cast<int>(v->op())));
+        child(v->left());
+        child(v->right());
+        close();
+      }
+
+      virtual void visit(a::FunctionCall* v) {
+        open("c");
+        name("", v->name());
+        for (auto c: v->args())
+          child(c);
+        close();
+      }
+
+      virtual void visit(a::SampleAccess* v) {
+        open("sa");
+        child(v->source());
+        child(v->index_node());
+        close();
+      }
+
+      virtual void visit(a::ArrayAccess* v) {
+        open("aa");
+        if (v->name().size())
+          name("n", v->name());
+        else
+          child(v->name_var());
+        child(v->index_node());
+        close();
+      }
+
+      virtual void visit(a::ValueAssignment* v) {
+        open("va");
+        name("n", v->value_name());
+        child(v->value_node());
+        close();
+      }
+
+      virtual void visit(a::ArrayAssignment* v) {
+        open("as");
+        child(v->array());
+        child(v->value_node());
+        close();
+      }
+
+      virtual void visit(a::Deref* v) {
+        open("d");
+        child(v->value_node());
+        close();
+      }
+
+    private:
+      std::string& mOut;
+
+      void open(const std::string& tag) { mOut += "(" + tag; }
+      void close() { mOut += ")"; }
+      void child(a::NodePtr n) {
+        mOut += " ";
+        n->accept(this);
+      }
+      //length prefixed so that names can hold any character
+      void name(const std::string& tag, const std::string& n) {
+        mOut += tag + std::to_string(n.size()) + ":" + n;
+      }
+  };
+}
+
+namespace xnor {
+  namespace ast {
+    std::string canonical(const std::vector<NodePtr>& trees) {
+      std::string out;
+      CanonicalVisitor v(out);
+      for (auto t: trees) {
+        t->accept(&v);
+        out += ";";
+      }
+      return out;
+    }
+  }
+}
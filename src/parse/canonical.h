@@ -0,0 +1,17 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#ifndef XNOR_CANONICAL_H
+#define XNOR_CANONICAL_H
+
+#include "ast.h"
+#include <string>
+#include <vector>
+
+namespace xnor {
+  namespace ast {
+    //a compact textual form of the trees that only depends on their structure,
+    //trees with equal canonical forms generate the same code
+    std::string canonical(const std::vector<NodePtr>& trees);
+  }
+}
+#endif
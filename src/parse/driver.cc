@@ -6,11 +6,13 @@
 #include <sstream>
 #include <map>
 #include <algorithm>
+#include <atomic>
 
 namespace parse
 {
     Driver::Driver()
-        : scanner_ (new Scanner()),
+        : mArena (std::make_shared<xnor::ast::Arena>()),
+          scanner_ (new Scanner()),
           parser_ (new Parser(*this)),
           location_ (new location())
     {
@@ -27,6 +29,9 @@ namespace parse
     void Driver::reset() {
       mTrees.clear();
       mInputs.clear();
+      clear_nodes();
+      //the old arena lives on with the trees that were handed out
+      mArena = std::make_shared<xnor::ast::Arena>();
 
       delete location_;
       location_ = new location();
@@ -38,6 +43,7 @@ namespace parse
       parser_->parse();
 
       validate();
+      clear_nodes();
       return trees();
     }
 
@@ -52,6 +58,7 @@ namespace parse
       s.close();
 
       validate();
+      clear_nodes();
       return trees();
     }
 
@@ -64,6 +71,7 @@ namespace parse
       parser_->parse();
 
       validate();
+      clear_nodes();
       return trees();
     }
 
@@ -76,6 +84,19 @@ namespace parse
       return i;
     }
 
+    std::size_t Driver::next_table_id() {
+      //tables are made the first time a node type is used, which can be on any thread
+      static std::atomic<std::size_t> next(0);
+      return next++;
+    }
+
+    void Driver::clear_nodes() {
+      for (auto& t: mNodes) {
+        if (t)
+          t->clear();
+      }
+    }
+
     void Driver::add_tree(xnor::ast::NodePtr v) { mTrees.push_back(v); }
     xnor::ast::VariablePtr Driver::add_input(xnor::ast::VariablePtr v) {
       for (auto i: mInputs) {
@@ -6,7 +6,11 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "ast.h"
+#include "arena.h"
 
 namespace parse
 {
@@ -36,9 +40,52 @@ namespace parse
             xnor::ast::VariablePtr add_input(xnor::ast::VariablePtr var);
             void validate();
 
+            //return the node made from the same arguments if there is one, otherwise allocate it
+            //in this parse's arena. the lookup happens first so duplicates are never allocated
+            template <typename T, typename... Args>
+              std::shared_ptr<T> make(Args&&... args) {
+                typedef xnor::ast::NodeKey<Args...> key_t;
+                auto& nodes = table<T, key_t>();
+                key_t key(xnor::ast::key_arg(args)...);
+                auto it = nodes.find(key);
+                if (it != nodes.end())
+                  return it->second;
+                auto n = std::allocate_shared<T>(xnor::ast::ArenaAllocator<T>(mArena), std::forward<Args>(args)...);
+                nodes.emplace(std::move(key), n);
+                return n;
+              }
+
         private:
+            //nodes made during the current parse, one table per node type and argument list
+            class NodeTable {
+              public:
+                virtual ~NodeTable() { }
+                virtual void clear() = 0;
+            };
+            template <typename T, typename K>
+              class NodeTableT : public NodeTable {
+                public:
+                  std::unordered_map<K, std::shared_ptr<T>, xnor::ast::NodeKeyHash> nodes;
+                  virtual void clear() override { nodes.clear(); }
+              };
+
+            static std::size_t next_table_id();
+            template <typename T, typename K>
+              std::unordered_map<K, std::shared_ptr<T>, xnor::ast::NodeKeyHash>& table() {
+                static const std::size_t id = next_table_id();
+                if (id >= mNodes.size())
+                  mNodes.resize(id + 1);
+                if (!mNodes[id])
+                  mNodes[id].reset(new NodeTableT<T, K>());
+                return static_cast<NodeTableT<T, K> *>(mNodes[id].get())->nodes;
+              }
+            void clear_nodes();
+
             TreeVector mTrees;
             xnor::ast::VariableVector mInputs;
+            std::shared_ptr<xnor::ast::Arena> mArena;
+            //indexed by table id, so equal subtrees are shared
+            std::vector<std::unique_ptr<NodeTable>> mNodes;
 
             Scanner*      scanner_;
             Parser*       parser_;
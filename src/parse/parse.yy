@@ -117,91 +117,87 @@ statement:
     | binary_op { $$ = $1; }
     | unary_op { $$ = $1; }
     | function_call { $$ = $1; }
-    | array_op { $$ = std::make_shared<xnor::ast::Deref>($1); }
+    | array_op { $$ = driver.make<xnor::ast::Deref>($1); }
     | sample_op { $$ = $1; }
     | OPEN_PAREN statement CLOSE_PAREN { $$ = $2; }
     | assign { $$ = $1; }
-    | statement NEG statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SUBTRACT, $3); }
-    | NEG statement %prec UMINUS { $$ = std::make_shared<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::NEGATE, $2); }
+    | statement NEG statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SUBTRACT, $3); }
+    | NEG statement %prec UMINUS { $$ = driver.make<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::NEGATE, $2); }
     ;
 
 assign :
-       STRING ASSIGN statement { $$ = std::make_shared<xnor::ast::ValueAssignment>($1, $3); }
-       | array_op ASSIGN statement { $$ = std::make_shared<xnor::ast::ArrayAssignment>($1, $3); }
+       STRING ASSIGN statement { $$ = driver.make<xnor::ast::ValueAssignment>($1, $3); }
+       | array_op ASSIGN statement { $$ = driver.make<xnor::ast::ArrayAssignment>($1, $3); }
        ;
 
 var : VAR  {
-      xnor::ast::VariablePtr var = std::make_shared<xnor::ast::Variable>($1);
+      xnor::ast::VariablePtr var = driver.make<xnor::ast::Variable>($1);
       var = driver.add_input(var);
       $$ = var;
     }
     ;
 
-constant : INT {
-          auto v = std::make_shared<xnor::ast::Value<int>>($1);
-          v->output_type(xnor::ast::Node::OutputType::INT);
-          $$ = v;
-          }
-         | FLOAT { $$ = std::make_shared<xnor::ast::Value<float>>($1); }
-         | STRING { $$ = std::make_shared<xnor::ast::Value<std::string>>($1); }
-         | VAR_DOLLAR { $$ = std::make_shared<xnor::ast::Value<std::string>>($1); }
+constant : INT { $$ = driver.make<xnor::ast::Value<int>>($1, xnor::ast::Node::OutputType::INT); }
+         | FLOAT { $$ = driver.make<xnor::ast::Value<float>>($1); }
+         | STRING { $$ = driver.make<xnor::ast::Value<std::string>>($1); }
+         | VAR_DOLLAR { $$ = driver.make<xnor::ast::Value<std::string>>($1); }
          ;
 
-quoted : QUOTE STRING QUOTE { $$ = std::make_shared<xnor::ast::Quoted>($2); }
+quoted : QUOTE STRING QUOTE { $$ = driver.make<xnor::ast::Quoted>($2); }
        | QUOTE VAR_SYMBOL QUOTE {
-            xnor::ast::VariablePtr var = std::make_shared<xnor::ast::Variable>($2);
+            xnor::ast::VariablePtr var = driver.make<xnor::ast::Variable>($2);
             var = driver.add_input(var);
-            $$ = std::make_shared<xnor::ast::Quoted>(var);
+            $$ = driver.make<xnor::ast::Quoted>(var);
           }
        ;
 
 binary_op : 
-          statement ADD statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::ADD, $3); }
-        | statement MULTIPLY statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::MULTIPLY, $3); }
-        | statement DIVIDE statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::DIVIDE, $3); }
-        | statement MOD statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::MOD, $3); }
-        | statement COMP_EQUAL statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_EQUAL, $3); }
-        | statement COMP_NOT_EQUAL statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_NOT_EQUAL, $3); }
-        | statement COMP_GREATER statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_GREATER, $3); }
-        | statement COMP_LESS statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_LESS, $3); }
-        | statement COMP_GREATER_OR_EQUAL statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_GREATER_OR_EQUAL, $3); }
-        | statement COMP_LESS_OR_EQUAL statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_LESS_OR_EQUAL, $3); }
-        | statement LOGICAL_OR statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::LOGICAL_OR, $3); }
-        | statement LOGICAL_AND statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::LOGICAL_AND, $3); }
-        | statement SHIFT_RIGHT statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SHIFT_RIGHT, $3); }
-        | statement SHIFT_LEFT statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SHIFT_LEFT, $3); }
-        | statement BIT_AND statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_AND, $3); }
-        | statement BIT_OR statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_OR, $3); }
-        | statement BIT_XOR statement { $$ = std::make_shared<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_XOR, $3); }
+          statement ADD statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::ADD, $3); }
+        | statement MULTIPLY statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::MULTIPLY, $3); }
+        | statement DIVIDE statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::DIVIDE, $3); }
+        | statement MOD statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::MOD, $3); }
+        | statement COMP_EQUAL statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_EQUAL, $3); }
+        | statement COMP_NOT_EQUAL statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_NOT_EQUAL, $3); }
+        | statement COMP_GREATER statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_GREATER, $3); }
+        | statement COMP_LESS statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_LESS, $3); }
+        | statement COMP_GREATER_OR_EQUAL statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_GREATER_OR_EQUAL, $3); }
+        | statement COMP_LESS_OR_EQUAL statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::COMP_LESS_OR_EQUAL, $3); }
+        | statement LOGICAL_OR statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::LOGICAL_OR, $3); }
+        | statement LOGICAL_AND statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::LOGICAL_AND, $3); }
+        | statement SHIFT_RIGHT statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SHIFT_RIGHT, $3); }
+        | statement SHIFT_LEFT statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::SHIFT_LEFT, $3); }
+        | statement BIT_AND statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_AND, $3); }
+        | statement BIT_OR statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_OR, $3); }
+        | statement BIT_XOR statement { $$ = driver.make<xnor::ast::BinaryOp>($1, xnor::ast::BinaryOp::Op::BIT_XOR, $3); }
         ;
 
-unary_op : UNOP_LOGICAL_NOT statement { $$ = std::make_shared<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::LOGICAL_NOT, $2); }
-         | UNOP_BIT_NOT statement { $$ = std::make_shared<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::BIT_NOT, $2); }
+unary_op : UNOP_LOGICAL_NOT statement { $$ = driver.make<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::LOGICAL_NOT, $2); }
+         | UNOP_BIT_NOT statement { $$ = driver.make<xnor::ast::UnaryOp>(xnor::ast::UnaryOp::Op::BIT_NOT, $2); }
          ;
 
-array_op : STRING OPEN_BRACKET statement CLOSE_BRACKET { $$ = std::make_shared<xnor::ast::ArrayAccess>($1, $3); }
+array_op : STRING OPEN_BRACKET statement CLOSE_BRACKET { $$ = driver.make<xnor::ast::ArrayAccess>($1, $3); }
          | VAR_SYMBOL OPEN_BRACKET statement CLOSE_BRACKET {
-              xnor::ast::VariablePtr var = std::make_shared<xnor::ast::Variable>($1);
+              xnor::ast::VariablePtr var = driver.make<xnor::ast::Variable>($1);
               var = driver.add_input(var);
-              $$ = std::make_shared<xnor::ast::ArrayAccess>(var, $3);
+              $$ = driver.make<xnor::ast::ArrayAccess>(var, $3);
             }
          ;
 
 sample_op : VAR_INDEXED OPEN_BRACKET statement CLOSE_BRACKET {
-            xnor::ast::VariablePtr var = std::make_shared<xnor::ast::Variable>($1);
+            xnor::ast::VariablePtr var = driver.make<xnor::ast::Variable>($1);
             var = driver.add_input(var);
-            $$ = std::make_shared<xnor::ast::SampleAccess>(var, $3);
+            $$ = driver.make<xnor::ast::SampleAccess>(var, $3);
          }
          | VAR_INDEXED {
            //$x# -> $x#[0]
            //$y# -> $y#[-1]
-           xnor::ast::VariablePtr var = std::make_shared<xnor::ast::Variable>($1);
+           xnor::ast::VariablePtr var = driver.make<xnor::ast::Variable>($1);
            var = driver.add_input(var);
-           auto val = std::make_shared<xnor::ast::Value<int>>(var->type() == xnor::ast::Variable::VarType::OUTPUT ? -1 : 0);
-           $$ = std::make_shared<xnor::ast::SampleAccess>(var, val);
+           auto val = driver.make<xnor::ast::Value<int>>(var->type() == xnor::ast::Variable::VarType::OUTPUT ? -1 : 0);
+           $$ = driver.make<xnor::ast::SampleAccess>(var, val);
          }
 
-function_call : STRING OPEN_PAREN call_args CLOSE_PAREN { $$ = std::make_shared<xnor::ast::FunctionCall>($1, $3); }
+function_call : STRING OPEN_PAREN call_args CLOSE_PAREN { $$ = driver.make<xnor::ast::FunctionCall>($1, $3); }
          ;
 
 call_arg : statement { $$ = $1; }
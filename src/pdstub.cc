@@ -0,0 +1,83 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+//stand-ins for the parts of pd that the compiler and runtime use, so tools can run without pd.
+//tables are made with pdstub_table and values live in a map
+
+#include "pdstub.h"
+#include <m_pd.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include <string>
+
+namespace {
+  std::map<std::string, t_symbol> symbols;
+  std::map<t_symbol *, t_float> values;
+  //the garray pointers pd_findbyclass gives out point to these
+  std::map<t_symbol *, std::vector<t_word>> tables;
+
+  void vprint(const char * prefix, const char * fmt, va_list args) {
+    fputs(prefix, stderr);
+    vfprintf(stderr, fmt, args);
+    fputs("\n", stderr);
+  }
+}
+
+extern "C" {
+  t_class * garray_class = nullptr;
+
+  t_symbol * gensym(const char * s) {
+    auto it = symbols.find(s);
+    if (it == symbols.end()) {
+      it = symbols.insert({s, t_symbol()}).first;
+      it->second.s_name = const_cast<char *>(it->first.c_str());
+      it->second.s_thing = nullptr;
+      it->second.s_next = nullptr;
+    }
+    return &it->second;
+  }
+
+  t_pd * pd_findbyclass(t_symbol * s, const t_class * /*c*/) {
+    auto it = tables.find(s);
+    return it == tables.end() ? nullptr : reinterpret_cast<t_pd *>(&it->second);
+  }
+
+  int garray_getfloatwords(t_garray * x, int * size, t_word ** vec) {
+    auto words = reinterpret_cast<std::vector<t_word> *>(x);
+    *size = static_cast<int>(words->size());
+    *vec = words->data();
+    return 1;
+  }
+
+  int value_getfloat(t_symbol * s, t_float * f) {
+    *f = values[s];
+    return 0;
+  }
+
+  int value_setfloat(t_symbol * s, t_float f) {
+    values[s] = f;
+    return 0;
+  }
+
+  void post(const char * fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprint("", fmt, args);
+    va_end(args);
+  }
+
+  void error(const char * fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprint("error: ", fmt, args);
+    va_end(args);
+  }
+}
+
+void pdstub_table(const std::string& name, const std::vector<float>& contents) {
+  auto& words = tables[gensym(name.c_str())];
+  words.resize(contents.size());
+  for (size_t i = 0; i < contents.size(); i++)
+    words[i].w_float = contents[i];
+}
@@ -0,0 +1,9 @@
+//Copyright (c) Alex Norman, 2018, see LICENSE-xnor
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+//make a table that the stand-in pd finds by name, replacing one with the same name
+void pdstub_table(const std::string& name, const std::vector<float>& values);
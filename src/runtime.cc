@@ -0,0 +1,146 @@
+//Copyright (c) Alex Norman, 2018.
+//see LICENSE-xnor
+
+#include "runtime.h"
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+#if defined (_MSC_VER)  // Visual studio
+    #define thread_local __declspec( thread )
+#elif defined (__GCC__) // GCC
+    #define thread_local __thread
+#endif
+
+thread_local jit_expr_helper_calls jit_expr_helper_counts;
+
+namespace {
+  int facti(int i) {
+    if (i <= 0)
+      return 1;
+    return i * facti(i - 1);
+  }
+
+  //adapted from max_ex_tab x_vexpr_if.c
+  t_word * jit_get_table(t_symbol *name, int& sizeout) {
+    t_garray * a;
+    sizeout = 0;
+    jit_expr_helper_counts.tables++;
+    t_word *vec;
+    if (!name || !(a = (t_garray *)pd_findbyclass(name, garray_class)) || !garray_getfloatwords(a, &sizeout, &vec)) {
+      sizeout = 0; //in case it was altered?
+      //XXX post error
+      return nullptr;
+    }
+    return vec;
+  }
+
+  //if end < 0, end == size
+  float jit_expr_table_sum_range(t_symbol * name, ssize_t start, ssize_t end) {
+    int s = 0;
+    t_word * vec = jit_get_table(name, s);
+    if (!vec)
+      return 0.0f;
+
+    ssize_t size = s;
+
+    start = std::min(std::max(start, static_cast<ssize_t>(0)), size);
+    if (end < 0)
+      end = size;
+    else
+      end = std::min(std::max(end, static_cast<ssize_t>(0)), size);
+
+    float sum = 0;
+    for (ssize_t i = start; i < end; i++)
+      sum += vec[i].w_float;
+    return sum;
+  }
+}
+
+float jit_expr_fact(float v) {
+  return static_cast<float>(facti(static_cast<int>(v)));
+}
+
+float * jit_expr_table_value_ptr(t_symbol * name, float findex) {
+  if (!name)
+    return nullptr;
+
+  int size = 0;
+  t_word * vec = jit_get_table(name, size);
+  if (!vec || size <= 0) {
+    return nullptr;
+  }
+  int index = std::min(std::max(0, static_cast<int>(findex)), size - 1);
+  return &(vec[index].w_float);
+}
+
+float * jit_expr_table_resolve(t_symbol * name, int * size) {
+  static t_word scratch;
+  t_word * vec = jit_get_table(name, *size);
+  if (!vec || *size <= 0) {
+    *size = 0;
+    return &scratch.w_float;
+  }
+  return &vec->w_float;
+}
+
+float jit_expr_table_size(t_symbol * name) {
+  int size = 0;
+  jit_get_table(name, size);
+  return static_cast<float>(size);
+}
+
+float jit_expr_table_sum(t_symbol * name, float fstart, float fend) {
+  if (fstart > fend || fend < 0)
+    return 0.0f;
+  return jit_expr_table_sum_range(name, static_cast<ssize_t>(fstart), static_cast<ssize_t>(fend) + 1);
+}
+
+float jit_expr_table_sum_all(t_symbol * name) {
+  return jit_expr_table_sum_range(name, 0, -1);
+}
+
+float jit_expr_max(float a, float b) { return std::max(a, b); }
+float jit_expr_min(float a, float b) { return std::min(a, b); }
+float jit_expr_random(float fstart, float fend) {
+  int start = static_cast<int>(fstart);
+  int end = static_cast<int>(fend - 1);
+  if (start >= end)
+    return 0;
+
+  //https://stackoverflow.com/questions/21237905/how-do-i-generate-thread-safe-uniform-random-numbers
+  static thread_local std::mt19937 generator;
+  std::uniform_int_distribution<int> distribution(start, end);
+  return static_cast<float>(distribution(generator));
+}
+
+float jit_expr_imodf(float v) {
+  return truncf(v);
+}
+
+float jit_expr_modf(float v) {
+  return v - truncf(v);
+}
+
+float jit_expr_isnan(float v) { return std::isnan(v) ? 1 : 0; }
+
+float jit_expr_isinf(float v) { return std::isinf(v) ? 1 : 0; }
+
+float jit_expr_finite(float v) { return std::isfinite(v) ? 1 : 0; }
+
+float jit_expr_value_assign(t_symbol * name, float v) {
+  jit_expr_helper_counts.value_sets++;
+  if (name)
+    value_setfloat(name, v);
+  return v;
+}
+
+float jit_expr_value_get(t_symbol * name) {
+  jit_expr_helper_counts.value_gets++;
+  float v = 0;
+  return (name && value_getfloat(name, &v) == 0) ? v : 0;
+}
+
+float jit_expr_deref(float * v) {
+  return v != 0 ? *v : 0;
+}
@@ -0,0 +1,39 @@
+//Copyright (c) Alex Norman, 2018.
+//see LICENSE-xnor
+
+#pragma once
+
+#include <m_pd.h>
+#include <cstdint>
+
+//calls generated code makes to the table and value helpers on this thread,
+//objects read them before and after their kernel runs to find their own share
+struct jit_expr_helper_calls {
+  uint64_t tables;
+  uint64_t value_gets;
+  uint64_t value_sets;
+};
+extern thread_local jit_expr_helper_calls jit_expr_helper_counts;
+
+//functions called from generated code
+extern "C" float jit_expr_fact(float v);
+extern "C" float * jit_expr_table_value_ptr(t_symbol * name, float findex);
+//the first float of the table, the floats are sizeof(t_word) apart.
+//a missing table has size 0 and points at a scratch word so access never needs a null check
+extern "C" float * jit_expr_table_resolve(t_symbol * name, int * size);
+extern "C" float jit_expr_table_size(t_symbol * name);
+extern "C" float jit_expr_table_sum(t_symbol * name, float start, float end);
+extern "C" float jit_expr_table_sum_all(t_symbol * name);
+extern "C" float jit_expr_max(float a, float b);
+extern "C" float jit_expr_min(float a, float b);
+extern "C" float jit_expr_random(float a, float b);
+extern "C" float jit_expr_imodf(float v);
+extern "C" float jit_expr_modf(float v);
+
+extern "C" float jit_expr_isnan(float v);
+extern "C" float jit_expr_isinf(float v);
+extern "C" float jit_expr_finite(float v);
+
+extern "C" float jit_expr_value_assign(t_symbol * name, float v);
+extern "C" float jit_expr_value_get(t_symbol * name);
+extern "C" float jit_expr_deref(float * v);